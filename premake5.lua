@@ -13,6 +13,8 @@ project "Twist"
 
     fatalwarnings {"ALL"}
 
+    vectorextensions "AVX2"
+
     includedirs {"src", "third_party"}
 
     files {
@@ -10,8 +10,14 @@
 #include "rapidobj/rapidobj.hpp"
 
 #include "renderer/renderer.hpp"
+#include "renderer/shadow_map.hpp"
+#include "renderer/spherical_harmonics.hpp"
+#include "renderer/radiance_filter.hpp"
+#include "renderer/irradiance_volume.hpp"
+#include "renderer/job_system.hpp"
 #include "utils/primitive.hpp"
 #include "utils/model_loader.hpp"
+#include "utils/texture_manager.hpp"
 #include "macaroni/rasterizer.h"
 #include "utils/image_io.hpp"
 
@@ -21,8 +27,8 @@
 #include <array>
 #include <chrono>
 #include <algorithm>
-#include <execution>
 #include <cstdint>
+#include <cfloat>
 #include <memory>
 #include <initializer_list>
 #include <filesystem>
@@ -74,11 +80,19 @@ static glm::mat4 get_cube_map_view_proj_matrix(const CubeMapIndex idx, const glm
     return proj * view;
 }
 
+static std::array<glm::mat4, 6> get_cube_map_view_proj_matrices(const glm::vec3& position) {
+    std::array<glm::mat4, 6> view_proj;
+    for (std::uint32_t i = static_cast<std::uint32_t>(CubeMapIndex::UP); i <= static_cast<std::uint32_t>(CubeMapIndex::BACK); i++)
+        view_proj.at(i) = get_cube_map_view_proj_matrix(static_cast<CubeMapIndex>(i), position);
+    return view_proj;
+}
+
 struct LightProbe {
     glm::vec3 position;
     std::uint32_t resolution = 128;
     std::array<Renderer::Image<R8G8B8A8_U>, 6> irradiance_map;
     std::array<Texture<R8G8B8A8_U>, 6> radiance_map;
+    Renderer::SH9 irradiance_sh; // evaluates to irradiance / pi, see compute_irradiance
 };
 
 void init_light_probe(LightProbe* probe, glm::vec3 position) {
@@ -110,98 +124,130 @@ void dump_light_probe(const LightProbe& probe, const std::filesystem::path& outp
         const std::filesystem::path path = output_dir / "rad" / std::to_string(i);
         const Renderer::Texture<Renderer::R8G8B8A8_U> tex = probe.radiance_map.at(i);
         ImageIO::dump_texture_to_ppm( tex, path);
+        ImageIO::dump_image_to_ppm(probe.irradiance_map.at(i), (output_dir / ("irradiance_" + std::to_string(i) + ".ppm")).string());
     }
 }
 
-glm::vec3 env_map_direction(size_t image_idx, glm::vec2 st){
-
-    float u = 2.0f * st.x - 1.0f;
-    float v = 2.0f * st.y - 1.0f;
-
-    glm::vec3 direction;
-
-    switch (static_cast<CubeMapIndex>(image_idx)) {
-        case CubeMapIndex::RIGHT:
-            direction = glm::vec3(1.0f, v, -u);
-            break;
-        case CubeMapIndex::LEFT:
-            direction = glm::vec3(-1.0f, v, u);
-            break;
-        case CubeMapIndex::UP:
-            direction = glm::vec3(u, 1.0f, -v);
-            break;
-        case CubeMapIndex::DOWN:
-            direction = glm::vec3(u, -1.0f, v);
-            break;
-        case CubeMapIndex::FRONT:
-            direction = glm::vec3(u, v, 1.0f);
-            break;
-        case CubeMapIndex::BACK:
-            direction = glm::vec3(-u, v, -1.0f);
-            break;
-        default:
-            direction = glm::vec3(0.0f);
-            break;
-    }    return glm::normalize(direction);
-};
-
-void diffuse_convolution (LightProbe* output_env_map, LightProbe* input_env_map){
-    if ((output_env_map->resolution != input_env_map->resolution)) {
-        std::cerr << "failed to convolut diffuse map\n";
-        return;
+// projects the radiance map onto spherical harmonics in a single pass and evaluates the
+// irradiance map from them, one O(1) lookup per texel
+void compute_irradiance(LightProbe* probe){
+    const std::array<glm::mat4, 6> view_proj = get_cube_map_view_proj_matrices(probe->position);
+    std::array<const Image<R8G8B8A8_U>*, 6> faces;
+    std::array<glm::mat4, 6> inv_view_proj;
+    for (std::uint32_t i = static_cast<std::uint32_t>(CubeMapIndex::UP); i <= static_cast<std::uint32_t>(CubeMapIndex::BACK); i++){
+        faces.at(i) = &probe->radiance_map.at(i).mipmaps.at(0);
+        inv_view_proj.at(i) = glm::inverse(view_proj.at(i));
     }
+    probe->irradiance_sh = Renderer::radiance_to_irradiance(Renderer::project_cube_map(faces, view_proj));
 
-    for (size_t i = 0; i < 6; i++){
-        std::cout << "convoluting env map face:" << i << "\n";
-        for (std::uint32_t y = 0; y < output_env_map->resolution; y++)
-        for (std::uint32_t x = 0; x < output_env_map->resolution; x++){
-            glm::vec4 sum = glm::vec4(0.f);
-            glm::vec3 N = env_map_direction( i, glm::vec2((float)y / output_env_map->resolution, (float)x / output_env_map->resolution));
-
-            for (size_t j = 0; j < 6; j++){
-                // std::cout << "gathering env map face:" << j << "\n";
-                for (std::uint32_t y1 = 0; y1 < input_env_map->resolution; y1++)
-                for (std::uint32_t x1 = 0; x1 < input_env_map->resolution; x1++){
-                    glm::vec3 L = env_map_direction( j, glm::vec2((float) y1 / input_env_map->resolution, (float) x1 / output_env_map->resolution));
-                    glm::vec4 I = to_vec4(input_env_map->radiance_map.at(i).mipmaps[0].at(x1, y1));
-                    sum += std::max(0.f, glm::dot(L, N)) * I;
-                }
-            }
-
-            output_env_map->radiance_map.at(i).mipmaps[0].at(x, y) = Renderer::to_r8g8b8a8_u(sum);
+    const std::uint32_t resolution = probe->resolution;
+    Renderer::parallel_for(6 * resolution, [&](std::uint32_t row){
+        const std::uint32_t face = row / resolution, y = row % resolution;
+        for (std::uint32_t x = 0; x < resolution; x++){
+            const glm::vec3 normal = Renderer::cube_texel_direction(inv_view_proj.at(face), x, y, resolution, resolution);
+            const glm::vec3 irradiance = Renderer::evaluate_sh9(probe->irradiance_sh, normal);
+            probe->irradiance_map.at(face).at(x, y) = Renderer::to_r8g8b8a8_u(glm::vec4(irradiance, 1.f));
         }
-    }
+    });
 }
 
-void draw_light_probe(LightProbe* probe, Scene& scene, Image<std::uint32_t>& shadow_map, const glm::mat4& light_mat, const glm::vec3& light_dir){
+void draw_light_probe(LightProbe* probe, Scene& scene, const CascadedShadowMap& shadow_map){
     const glm::vec3 position = probe->position;
+    const std::array<glm::mat4, 6> view_proj = get_cube_map_view_proj_matrices(position);
+    std::cout << "probe pos: " << glm::to_string(probe->position) << "\n";
 
-    Renderer::Image<std::uint32_t> depth_buffer{
-        .image = std::vector<std::uint32_t>(probe->resolution * probe->resolution),
-        .width = probe->resolution,
-        .height = probe->resolution,
-    };
-    auto depth_buffer_view = create_imageview(depth_buffer, probe->resolution, probe->resolution);
-
+    // all six faces are drawn by one multiview draw per mesh, each face needs its own depth buffer
+    std::array<Renderer::Image<std::uint32_t>, 6> depth_buffers;
+    std::vector<Renderer::FrameBuffer> frame_buffers(6);
+    std::vector<Renderer::View> views(6);
     for (std::uint32_t i = static_cast<std::uint32_t>(CubeMapIndex::UP); i <= static_cast<std::uint32_t>(CubeMapIndex::BACK); i++) {
-        clear(&depth_buffer_view, 0xFFFFFFFF);
+        depth_buffers.at(i) = Renderer::Image<std::uint32_t>{
+            .image = std::vector<std::uint32_t>(probe->resolution * probe->resolution, 0xFFFFFFFF),
+            .width = probe->resolution,
+            .height = probe->resolution,
+        };
 
         auto rad_map_img_view = create_imageview(probe->radiance_map.at(i).mipmaps.at(0), probe->resolution, probe->resolution);
         clear(&rad_map_img_view, R8G8B8A8_U(255, 0, 0, 255));
 
-        Renderer::FrameBuffer frame_buffer = {
+        frame_buffers.at(i) = Renderer::FrameBuffer{
             .color_buffer_view = rad_map_img_view,
-            .depth_buffer_view = depth_buffer_view,
+            .depth_buffer_view = create_imageview(depth_buffers.at(i), probe->resolution, probe->resolution),
         };
+        views.at(i) = Renderer::View{
+            .frame_buffer = &frame_buffers.at(i),
+            .vp_transform = view_proj.at(i),
+            .viewport = { .x = 0, .y = 0, .width = probe->resolution, .height = probe->resolution },
+        };
+    }
 
-        const glm::mat4 vp_mat = get_cube_map_view_proj_matrix(static_cast<CubeMapIndex>(i), position);
-        std::cout << "probe pos: " << glm::to_string(probe->position) << "\n";
-        const Renderer::ViewPort viewport {
-            .x = 0, .y = 0, .width = probe->resolution, .height = probe->resolution,
+    for (auto& mesh : scene.meshes) {
+        Renderer::DrawCall call {
+            .cull_mode = Renderer::CullMode::CLOCK_WISE,
+            .depth_settings = {
+                .write = true,
+                .test_mode = Renderer::DepthTestMode::LESS,
+            },
+            .vertex_buffer = &mesh.vertices,
+            .index_buffer = &mesh.indices,
+            .quantization = mesh.quantization,
+            .material = &mesh.material,
+            .world_transform = glm::identity<glm::mat4>(),
+            .shadows = &shadow_map.cascades,
+            .light_mat = shadow_map.light_view,
+            .light_direction = shadow_map.light_dir,
         };
+        Renderer::draw_multiview(views, call);
+    }
 
-        for (auto& mesh : scene.meshes) {
-            Renderer::DrawCall call {
+    Renderer::parallel_for(6, [&](std::uint32_t i){ Renderer::generate_mipmaps(&probe->radiance_map.at(i)); });
+
+    // box filtered mips are only the input of the ggx prefilter, which replaces them
+    Renderer::prefilter_radiance(&probe->radiance_map, view_proj);
+
+    std::cout << "finished radiance map";
+    compute_irradiance(probe);
+    dump_light_probe(*probe, "./bin/probes");
+}
+
+// renders the six faces of an irradiance volume probe at low resolution and projects them onto
+// SH irradiance. called from several workers at once, so everything it writes is local.
+Renderer::SH9 bake_volume_probe(Scene& scene, const CascadedShadowMap& shadow_map, const glm::vec3& position, R8G8B8A8_U sky_color){
+    constexpr std::uint32_t resolution = 32;
+    const std::array<glm::mat4, 6> view_proj = get_cube_map_view_proj_matrices(position);
+
+    std::array<Renderer::Image<R8G8B8A8_U>, 6> faces;
+    std::array<Renderer::Image<std::uint32_t>, 6> depth_buffers;
+    std::vector<Renderer::FrameBuffer> frame_buffers(6);
+    std::vector<Renderer::View> views(6);
+    for (std::uint32_t i = static_cast<std::uint32_t>(CubeMapIndex::UP); i <= static_cast<std::uint32_t>(CubeMapIndex::BACK); i++) {
+        faces.at(i) = Image<R8G8B8A8_U>{
+            .image = std::vector<R8G8B8A8_U>(resolution * resolution, sky_color),
+            .width = resolution,
+            .height = resolution,
+        };
+        depth_buffers.at(i) = Image<std::uint32_t>{
+            .image = std::vector<std::uint32_t>(resolution * resolution, 0xFFFFFFFF),
+            .width = resolution,
+            .height = resolution,
+        };
+        frame_buffers.at(i) = Renderer::FrameBuffer{
+            .color_buffer_view = create_imageview(faces.at(i), resolution, resolution),
+            .depth_buffer_view = create_imageview(depth_buffers.at(i), resolution, resolution),
+        };
+        views.at(i) = Renderer::View{
+            .frame_buffer = &frame_buffers.at(i),
+            .vp_transform = view_proj.at(i),
+            .viewport = { .x = 0, .y = 0, .width = resolution, .height = resolution },
+        };
+    }
+
+    for (auto& mesh : scene.meshes) {
+        bool is_transparant = glm::length2(mesh.material.transmittance) < 0.99f;
+        if (is_transparant) continue;
+        draw_multiview(
+            views,
+            {
                 .cull_mode = Renderer::CullMode::CLOCK_WISE,
                 .depth_settings = {
                     .write = true,
@@ -209,30 +255,19 @@ void draw_light_probe(LightProbe* probe, Scene& scene, Image<std::uint32_t>& sha
                 },
                 .vertex_buffer = &mesh.vertices,
                 .index_buffer = &mesh.indices,
+                .quantization = mesh.quantization,
                 .material = &mesh.material,
                 .world_transform = glm::identity<glm::mat4>(),
-                .vp_transform = vp_mat,
-                .shadow_map = &shadow_map,
-                .light_mat = light_mat,
-                .light_direction = light_dir,
-            };
-            Renderer::draw(
-                &frame_buffer, 
-                call,
-                viewport
-            );
-        }
-
-        Renderer::generate_mipmaps(&probe->radiance_map.at(i));
+                .shadows = &shadow_map.cascades,
+                .light_mat = shadow_map.light_view,
+                .light_direction = shadow_map.light_dir,
+            }
+        );
     }
 
-    std::cout << "finished radiance map";
-    // dump_light_probe(*probe, "./bin/probes");
-    LightProbe rad_env_map{};
-    init_light_probe(&rad_env_map, glm::vec3(0.f, 0.1f, 0.f));
-    diffuse_convolution (&rad_env_map, probe);
-    for (int i = 0; i < 6; i++) Renderer::generate_mipmaps(&rad_env_map.radiance_map.at(i));
-    dump_light_probe(rad_env_map, "./bin/probes");
+    std::array<const Image<R8G8B8A8_U>*, 6> face_ptrs;
+    for (std::uint32_t i = 0; i < 6; i++) face_ptrs.at(i) = &faces.at(i);
+    return Renderer::radiance_to_irradiance(Renderer::project_cube_map(face_ptrs, view_proj));
 }
 
 int main() {
@@ -259,35 +294,54 @@ int main() {
         .height = height,
     };
     auto depth_buffer_view = create_imageview(depth_buffer, width, height);
+    Renderer::HiZBuffer hiz_buffer = Renderer::create_hiz_buffer(width, height);
+
+    Renderer::Image<Renderer::VisibilityId> visibility_buffer = {
+        .image = std::vector<Renderer::VisibilityId>(width * height),
+        .width = width,
+        .height = height,
+    };
+    auto visibility_buffer_view = create_imageview(visibility_buffer, width, height);
 
     Renderer::FrameBuffer frame_buffer = {
         .color_buffer_view = render_target_view,
         .depth_buffer_view = depth_buffer_view,
-    };
-
-    constexpr int shadow_map_width = 2048, shadow_map_height = 2048;
-    Renderer::Image<std::uint32_t> shadow_map = {
-        .image = std::vector<std::uint32_t>(shadow_map_width * shadow_map_height),
-        .width = shadow_map_width,
-        .height = shadow_map_height,
-    };
-    auto shadow_map_view = create_imageview(shadow_map, shadow_map_width, shadow_map_height);
-    Renderer::FrameBuffer shadow_frame_buffer = {
-        .color_buffer_view = std::nullopt,
-        .depth_buffer_view = shadow_map_view,
+        .hiz_buffer = &hiz_buffer,
     };
 
     auto box_mesh = Primitives::create_cube();
 
     Renderer::Scene scene;
-    ModelLoader::load_scene(&scene, "./resource/sibenik/sibenik.obj");
-    // ModelLoader::load_scene(&scene, "./resource/camera/camera.obj");
+    // the light probe is baked by a job of the texture cache, so it has to outlive it
+    Renderer::CascadedShadowMap probe_shadow_map = Renderer::create_cascaded_shadow_map({
+        .resolution = 2048,
+        .fit_to_casters = true,
+    });
+    LightProbe probe = {};
+    init_light_probe(&probe, glm::vec3(0.f, 0.1f, 0.f));
+    // textures stream in while the first frames are drawn with placeholders
+    TextureManager::TextureCache texture_cache{ .textures = &scene.textures };
+    ModelLoader::load_scene(&scene, &texture_cache, "./resource/sibenik/sibenik.obj");
+    // ModelLoader::load_scene(&scene, &texture_cache, "./resource/camera/camera.obj");
+
+    std::vector<Renderer::ShadowCaster> shadow_casters;
+    for (auto& mesh : scene.meshes){
+        bool is_transparant = glm::length2(mesh.material.transmittance) < 0.99f;
+        if (is_transparant) continue;
+        shadow_casters.push_back(Renderer::create_shadow_caster(&mesh.vertices, &mesh.indices, mesh.quantization, glm::identity<glm::mat4>()));
+    }
+    Renderer::CascadedShadowMap shadow_map = Renderer::create_cascaded_shadow_map({});
 
     Renderer::R8G8B8A8_U clear_color = {255, 200, 200, 255};
 
-    LightProbe probe = {};
-    init_light_probe(&probe, glm::vec3(0.f, 0.1f, 0.f));
-    
+    glm::vec3 scene_min(FLT_MAX), scene_max(-FLT_MAX);
+    for (const auto& caster : shadow_casters){
+        scene_min = glm::min(scene_min, caster.bounds_min);
+        scene_max = glm::max(scene_max, caster.bounds_max);
+    }
+    Renderer::IrradianceVolume irradiance_volume = Renderer::create_irradiance_volume(scene_min, scene_max, 4.f);
+    constexpr std::uint32_t probes_per_frame = 8;
+
 
     // timer
     auto last_frame_start = std::chrono::high_resolution_clock::now();
@@ -295,6 +349,8 @@ int main() {
     // state
     bool running = true;
     bool dump_image = false;
+    bool use_visibility_buffer = false;
+    bool animate_light = false;
     float time = 0.f;
 
     glm::vec3 camera_pos = {0.f, 0.f, -1.f};
@@ -302,44 +358,21 @@ int main() {
     glm::vec2 mouse_pos = {0.f, 0.f};
     float camera_speed = 1.f;
 
-    // shadow pass
+    // camera
+    const float camera_fov = glm::radians(90.0f);
+    const float camera_aspect = static_cast<float>(width) / height;
+    const float camera_near = 0.1f;
+
+    // light
     glm::vec3 light_lookat = {0.f, 0.f, 0.f};
     glm::vec3 light_pos = {10.f, 50.f, -50.f};
-    clear(&shadow_map_view, 0xFFFFFFFF);
+    float light_rotation = 0.f;
 
-    Renderer::ViewPort shadow_viewport{
-        .x = 0,
-        .y = 0, 
-        .width = shadow_map_width,
-        .height = shadow_map_height,
-    };
-    auto shadow_proj = glm::ortho<float>(-50, 50, -50, 50, 0.1f, 100.f);
-    auto shadow_view = glm::lookAt(light_pos, light_lookat, glm::vec3(1.f, 0.f, 0.f));
-    for (auto& mesh: scene.meshes){
-        bool is_transparant = glm::length2(mesh.material.transmittance) < 0.99f;
-        if (is_transparant) continue;
-        draw(
-            &shadow_frame_buffer,
-            {
-                .cull_mode = Renderer::CullMode::CLOCK_WISE,
-                .depth_settings = {
-                    .write = true,
-                    .test_mode = Renderer::DepthTestMode::LESS,
-                },
-                .vertex_buffer = &mesh.vertices,
-                .index_buffer = &mesh.indices,
-                .material = nullptr,
-                .world_transform = glm::identity<glm::mat4>(),
-                .vp_transform = shadow_proj * shadow_view,
-            },
-            shadow_viewport
-        );
-    }
-
-    // light probe pass
-    const glm::mat4 light_mat = shadow_proj * shadow_view;
+    // light probe pass, the probe looks in every direction so it gets a single map over all casters.
+    // it is baked once the real textures are in, the frames only read the scene and the map meanwhile.
     const glm::vec3 light_dir = glm::normalize(light_lookat - light_pos);
-    draw_light_probe(&probe, scene, shadow_map, light_mat, light_dir);
+    Renderer::update_cascaded_shadow_map(&probe_shadow_map, shadow_casters, { .view_mat = glm::identity<glm::mat4>(), .fov_y = camera_fov, .aspect = 1.f, .near_plane = camera_near }, light_dir);
+    TextureManager::run_when_streamed(&texture_cache, [&]{ draw_light_probe(&probe, scene, probe_shadow_map); });
     // dump_light_probe(probe, "./bin/probes/");
 
     while(running) {
@@ -357,6 +390,12 @@ int main() {
             case SDL_KeyCode::SDLK_p:
                 dump_image = true;
                 break;
+            case SDL_KeyCode::SDLK_v:
+                use_visibility_buffer = !use_visibility_buffer;
+                break;
+            case SDL_KeyCode::SDLK_l:
+                animate_light = !animate_light;
+                break;
             case SDL_KeyCode::SDLK_w:
                 camera_pos.y -= camera_speed;
                 break;
@@ -395,13 +434,15 @@ int main() {
         time += delta_time;
         last_frame_start = now;
 
-        std::ostringstream title;
-        title << "FPS:" << 1.f / delta_time;
-        SDL_SetWindowTitle(window, title.str().c_str());
-        
         // clear color
         clear(&render_target_view, clear_color);  
-        clear(&depth_buffer_view, 0xFFFFFFFF);
+        clear_depth(&frame_buffer, 0xFFFFFFFF);
+        if (use_visibility_buffer){
+            frame_buffer.visibility_buffer_view = visibility_buffer_view;
+            clear(&visibility_buffer_view, Renderer::EMPTY_VISIBILITY_ID);
+        } else {
+            frame_buffer.visibility_buffer_view = std::nullopt;
+        }
 
         Renderer::ViewPort viewport = {
             .x = 0,
@@ -414,34 +455,73 @@ int main() {
         auto view_mat = glm::identity<glm::mat4>();
         view_mat = glm::rotate(view_mat, y_rotation, glm::vec3(0.f, -1.f, 0.f));
         view_mat = glm::translate(view_mat, camera_pos);
-        auto proj_mat = glm::perspective(glm::radians(90.0f), static_cast<float>(width) / height, 0.1f, 100.f);
+        auto proj_mat = glm::perspective(camera_fov, camera_aspect, camera_near, 100.f);
+
+        // shadow pass, only the cascades whose bounds, light or casters changed are re-rendered
+        if (animate_light) light_rotation += delta_time * 0.2f;
+        const glm::vec3 rotated_light_pos = glm::vec3(glm::rotate(glm::identity<glm::mat4>(), light_rotation, glm::vec3(0.f, 1.f, 0.f)) * glm::vec4(light_pos, 1.f));
+        Renderer::update_cascaded_shadow_map(
+            &shadow_map,
+            shadow_casters,
+            {
+                .view_mat = view_mat,
+                .fov_y = camera_fov,
+                .aspect = camera_aspect,
+                .near_plane = camera_near,
+            },
+            light_lookat - rotated_light_pos
+        );
+
+        // textures decoded since the last frame replace their placeholders, the probes were baked
+        // with the placeholders and are baked again over the next frames once every texture is in
+        const std::uint32_t streaming_textures = TextureManager::get_streaming_count(texture_cache);
+        if (TextureManager::update_textures(&texture_cache) == streaming_textures && streaming_textures > 0)
+            Renderer::invalidate_irradiance_volume(&irradiance_volume, scene_min, scene_max);
 
+        // only probes near geometry that moved since the last frame are baked again, see
+        // invalidate_irradiance_volume. a few per frame, the rest keep their old light until then.
+        const std::uint32_t baked_probes = Renderer::bake_irradiance_volume(&irradiance_volume, [&](const glm::vec3& position){
+            return bake_volume_probe(scene, probe_shadow_map, position, clear_color);
+        }, probes_per_frame);
+
+        Renderer::DrawStats draw_stats;
+        std::vector<Renderer::DrawCall> draws;
         for (auto& mesh : scene.meshes) {
             // remove glasses
             bool is_transparant = glm::length2(mesh.material.transmittance) < 0.99f;
             if (is_transparant) continue;
 
-            draw_new(
-                &frame_buffer, 
-                {
-                    .cull_mode = Renderer::CullMode::CLOCK_WISE,
-                    .depth_settings = {
-                        .write = true,
-                        .test_mode = Renderer::DepthTestMode::LESS,
-                    },
-                    .vertex_buffer = &mesh.vertices,
-                    .index_buffer = &mesh.indices,
-                    .material = &mesh.material,
-                    .world_transform = glm::identity<glm::mat4>(),
-                    .vp_transform = proj_mat * view_mat,
-                    .shadow_map = &shadow_map,
-                    .light_mat = shadow_proj * shadow_view,
-                    .light_direction = glm::normalize(light_lookat - light_pos),
+            draws.push_back({
+                .cull_mode = Renderer::CullMode::CLOCK_WISE,
+                .depth_settings = {
+                    .write = true,
+                    .test_mode = Renderer::DepthTestMode::LESS,
                 },
-                viewport  
-            );
+                .vertex_buffer = &mesh.vertices,
+                .index_buffer = &mesh.indices,
+                .quantization = mesh.quantization,
+                .material = &mesh.material,
+                .world_transform = glm::identity<glm::mat4>(),
+                .vp_transform = proj_mat * view_mat,
+                .shadows = &shadow_map.cascades,
+                .light_mat = shadow_map.light_view,
+                .light_direction = shadow_map.light_dir,
+                .irradiance_volume = &irradiance_volume,
+                .draw_id = static_cast<std::uint32_t>(draws.size()),
+                .stats = &draw_stats,
+            });
         }
 
+        for (auto& draw : draws) draw_new(&frame_buffer, draw, viewport);
+        if (use_visibility_buffer) shade_visibility(&frame_buffer, draws, viewport);
+
+        std::ostringstream title;
+        title << "FPS:" << 1.f / delta_time << " vertex cache hit rate:" << draw_stats.vertex_cache_hit_rate()
+            << " shadow cascades rendered:" << shadow_map.rendered_cascades
+            << " probes baked:" << baked_probes << " probes dirty:" << Renderer::get_dirty_probe_count(irradiance_volume)
+            << " textures streaming:" << TextureManager::get_streaming_count(texture_cache);
+        SDL_SetWindowTitle(window, title.str().c_str());
+
         SDL_Rect rect{
             .x = 0, .y = 0, .w = width, .h = height
         };
@@ -449,7 +529,8 @@ int main() {
         SDL_UpdateWindowSurface(window);
 
         if (dump_image) {
-            ImageIO::dump_image_to_ppm(shadow_map, "./bin/shadow_map.ppm");
+            for (std::uint32_t i = 0; i < shadow_map.cascades.count; i++)
+                ImageIO::dump_image_to_ppm(shadow_map.states[i].depth_map, "./bin/shadow_cascade_" + std::to_string(i) + ".ppm");
             dump_image = false;
         }
     };
@@ -0,0 +1,96 @@
+#include "irradiance_volume.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace Renderer;
+
+IrradianceVolume Renderer::create_irradiance_volume(const glm::vec3& bounds_min, const glm::vec3& bounds_max, float probe_spacing){
+    // flat bounds still get two layers of probes a little apart so the grid can be sampled
+    const glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(0.01f));
+    const glm::uvec3 resolution = glm::uvec3(glm::max(glm::ceil(extent / probe_spacing) + 1.f, glm::vec3(2.f)));
+    const std::uint32_t probe_count = resolution.x * resolution.y * resolution.z;
+    return IrradianceVolume{
+        .bounds_min = bounds_min,
+        .bounds_max = bounds_min + extent,
+        .resolution = resolution,
+        .probes = std::vector<IrradianceProbe>(probe_count),
+        .dirty = std::vector<std::uint8_t>(probe_count, 1),
+        // a moved mesh mostly changes the light of the probes of the cells around it
+        .influence_distance = 2.f * probe_spacing,
+    };
+}
+
+glm::vec3 Renderer::get_probe_position(const IrradianceVolume& volume, std::uint32_t index){
+    const glm::uvec3 cell(
+        index % volume.resolution.x,
+        index / volume.resolution.x % volume.resolution.y,
+        index / (volume.resolution.x * volume.resolution.y));
+    const glm::vec3 t = glm::vec3(cell) / glm::vec3(volume.resolution - 1u);
+    return volume.bounds_min + (volume.bounds_max - volume.bounds_min) * t;
+}
+
+void Renderer::invalidate_irradiance_volume(IrradianceVolume* volume, const glm::vec3& bounds_min, const glm::vec3& bounds_max){
+    const float max_distance2 = volume->influence_distance * volume->influence_distance;
+    for (std::uint32_t i = 0; i < volume->probes.size(); i++){
+        const glm::vec3 position = get_probe_position(*volume, i);
+        const glm::vec3 offset = position - glm::clamp(position, bounds_min, bounds_max);
+        if (glm::dot(offset, offset) <= max_distance2) volume->dirty[i] = 1;
+    }
+}
+
+std::uint32_t Renderer::bake_irradiance_volume(IrradianceVolume* volume, const std::function<SH9(const glm::vec3&)>& bake_probe, std::uint32_t max_probes){
+    std::vector<std::uint32_t> probes;
+    for (std::uint32_t i = 0; i < volume->probes.size() && probes.size() < max_probes; i++)
+        if (volume->dirty[i]) probes.push_back(i);
+    if (probes.empty()) return 0;
+
+    // one probe per task, workers left without probes steal pieces of the draws inside bake_probe
+    parallel_for(static_cast<std::uint32_t>(probes.size()), [&](std::uint32_t i){
+        const SH9 sh = bake_probe(get_probe_position(*volume, probes[i]));
+        std::memcpy(volume->probes[probes[i]].coefficients.data(), sh.coefficients.data(), sizeof(SH9));
+    });
+    for (const std::uint32_t i : probes) volume->dirty[i] = 0;
+    return static_cast<std::uint32_t>(probes.size());
+}
+
+std::uint32_t Renderer::get_dirty_probe_count(const IrradianceVolume& volume){
+    return static_cast<std::uint32_t>(std::count(volume.dirty.begin(), volume.dirty.end(), std::uint8_t(1)));
+}
+
+glm::vec3 Renderer::sample_irradiance(const IrradianceVolume* volume, const glm::vec3& position, const glm::vec3& normal){
+    if (!volume) return glm::vec3(0.f);
+
+    // cell of the grid containing the position, positions outside of it use the nearest face
+    const glm::uvec3 resolution = volume->resolution;
+    const glm::vec3 grid_max = glm::vec3(resolution - 1u);
+    const glm::vec3 p = glm::clamp((position - volume->bounds_min) / (volume->bounds_max - volume->bounds_min) * grid_max, glm::vec3(0.f), grid_max);
+    const glm::uvec3 cell = glm::min(glm::uvec3(p), resolution - 2u);
+    const glm::vec3 t = p - glm::vec3(cell);
+
+    // SH is linear, blending the coefficients first needs one evaluation instead of eight
+    const std::uint32_t stride_y = resolution.x, stride_z = resolution.x * resolution.y;
+    const IrradianceProbe* base = &volume->probes[cell.x + stride_y * cell.y + stride_z * cell.z];
+    const std::array<const IrradianceProbe*, 8> probes = {
+        base, base + 1, base + stride_y, base + stride_y + 1,
+        base + stride_z, base + stride_z + 1, base + stride_z + stride_y, base + stride_z + stride_y + 1,
+    };
+    const std::array<float, 8> weights = {
+        (1.f - t.x) * (1.f - t.y) * (1.f - t.z), t.x * (1.f - t.y) * (1.f - t.z),
+        (1.f - t.x) * t.y * (1.f - t.z), t.x * t.y * (1.f - t.z),
+        (1.f - t.x) * (1.f - t.y) * t.z, t.x * (1.f - t.y) * t.z,
+        (1.f - t.x) * t.y * t.z, t.x * t.y * t.z,
+    };
+    alignas(32) std::array<float, 32> blended{};
+    for (std::uint32_t corner = 0; corner < 8; corner++){
+        const float* coefficients = probes[corner]->coefficients.data();
+        for (std::uint32_t i = 0; i < 32; i++) blended[i] += coefficients[i] * weights[corner];
+    }
+
+    const auto basis = sh9_basis(normal);
+    glm::vec3 irradiance(0.f);
+    for (std::uint32_t i = 0; i < 9; i++)
+        irradiance += glm::vec3(blended[3 * i], blended[3 * i + 1], blended[3 * i + 2]) * basis[i];
+    return glm::max(irradiance, glm::vec3(0.f));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "spherical_harmonics.hpp"
+
+#include <functional>
+
+namespace Renderer{
+// SH9 irradiance of a probe as flat rgb triples, padded to 32 floats so that blending whole
+// probes compiles to 8 wide vector operations
+struct alignas(32) IrradianceProbe{
+    std::array<float, 32> coefficients{};
+};
+static_assert(sizeof(SH9) == 27 * sizeof(float));
+
+// probes on a regular grid spanning bounds_min to bounds_max, each holding the SH irradiance
+// (see radiance_to_irradiance) seen from its position. probe (x, y, z) is at index
+// x + resolution.x * (y + resolution.y * z).
+struct IrradianceVolume{
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+    glm::uvec3 resolution;
+    std::vector<IrradianceProbe> probes;
+    std::vector<std::uint8_t> dirty; // probes that have to be baked again
+    // geometry changes farther than this from a probe do not invalidate it
+    float influence_distance;
+};
+
+// probes are spaced at most probe_spacing apart, with at least 2 along every axis
+IrradianceVolume create_irradiance_volume(const glm::vec3& bounds_min, const glm::vec3& bounds_max, float probe_spacing);
+
+glm::vec3 get_probe_position(const IrradianceVolume& volume, std::uint32_t index);
+
+// marks the probes within influence_distance of a world space box, call it with the old and the
+// new bounds of a mesh that moved
+void invalidate_irradiance_volume(IrradianceVolume* volume, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+
+// bakes up to max_probes dirty probes with bake_probe, which gets a probe position and returns the
+// SH irradiance there, the others stay dirty for a later call. probes are spread over all workers,
+// bake_probe may be called from several at once. returns the number of probes baked.
+std::uint32_t bake_irradiance_volume(IrradianceVolume* volume, const std::function<SH9(const glm::vec3&)>& bake_probe, std::uint32_t max_probes);
+
+// number of probes still waiting for bake_irradiance_volume
+std::uint32_t get_dirty_probe_count(const IrradianceVolume& volume);
+}
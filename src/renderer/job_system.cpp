@@ -0,0 +1,218 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace Renderer;
+
+namespace {
+struct Job{
+    std::function<void()> work;
+    // nesting level, jobs of a parallel_for called from a job of depth d have depth d + 1
+    std::uint32_t depth;
+};
+
+struct WorkQueue{
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+// index of the queue of the calling thread, 0 is shared by every thread outside of the pool
+thread_local std::uint32_t worker_index = 0;
+// depth of the job the calling thread is running, 0 outside of any job
+thread_local std::uint32_t job_depth = 0;
+
+struct WorkerPool{
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<std::int32_t> queued{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool quit = false;
+
+    WorkerPool(){
+        const std::uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (std::uint32_t i = 0; i < hardware; i++)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (std::uint32_t i = 1; i < hardware; i++)
+            threads.emplace_back([this, i]{ worker_main(i); });
+    }
+
+    ~WorkerPool(){
+        {
+            std::lock_guard lock(sleep_mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    void push_job(Job job){
+        {
+            WorkQueue& queue = *queues[worker_index];
+            std::lock_guard lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        queued.fetch_add(1);
+        // taking the lock orders the increment before a sleeping worker's check of queued
+        { std::lock_guard lock(sleep_mutex); }
+        wake.notify_one();
+    }
+
+    // own queue from the back, where the smallest and most recent pieces are, other queues from
+    // the front, where the biggest pieces are. only jobs of at least min_depth are taken, jobs
+    // that are too shallow are skipped over.
+    bool take_job(std::uint32_t min_depth, Job* job){
+        if (queued.load() <= 0) return false;
+        const std::uint32_t queue_count = static_cast<std::uint32_t>(queues.size());
+        auto is_allowed = [min_depth](const Job& candidate){ return candidate.depth >= min_depth; };
+        for (std::uint32_t i = 0; i < queue_count; i++){
+            WorkQueue& queue = *queues[(worker_index + i) % queue_count];
+            std::lock_guard lock(queue.mutex);
+            auto it = queue.jobs.end();
+            if (i == 0){
+                const auto last = std::find_if(queue.jobs.rbegin(), queue.jobs.rend(), is_allowed);
+                if (last != queue.jobs.rend()) it = std::prev(last.base());
+            } else {
+                it = std::find_if(queue.jobs.begin(), queue.jobs.end(), is_allowed);
+            }
+            if (it == queue.jobs.end()) continue;
+            *job = std::move(*it);
+            queue.jobs.erase(it);
+            queued.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run_job(Job& job){
+        const std::uint32_t saved_depth = job_depth;
+        job_depth = job.depth;
+        job.work();
+        job_depth = saved_depth;
+    }
+
+    // runs queued jobs until remaining drops to zero. min_depth is the depth of the jobs the caller
+    // queued, one below the job the caller runs in. jobs of min_depth or deeper are taken, so the
+    // caller's own pieces and pieces other loops queued at the same nesting level, but never a job
+    // as shallow as the caller's: every job run inline is nested deeper than the one it runs on top
+    // of, which bounds the stack to the nesting depth instead of the number of queued jobs. pieces
+    // of another loop are safe to run here, they only ever wait on jobs deeper than themselves.
+    void wait(const std::atomic<std::uint32_t>& remaining, std::uint32_t min_depth){
+        while (remaining.load(std::memory_order_acquire) != 0){
+            Job job;
+            if (take_job(min_depth, &job)) run_job(job);
+            else std::this_thread::yield();
+        }
+    }
+
+    void worker_main(std::uint32_t index);
+};
+
+void WorkerPool::worker_main(std::uint32_t index){
+    worker_index = index;
+    for (;;){
+        Job job;
+        if (take_job(0, &job)){
+            run_job(job);
+            continue;
+        }
+
+        std::unique_lock lock(sleep_mutex);
+        wake.wait(lock, [&]{ return quit || queued.load() > 0; });
+        if (quit) return;
+    }
+}
+
+WorkerPool& get_pool(){
+    static WorkerPool pool;
+    return pool;
+}
+}
+
+std::uint32_t Renderer::worker_count(){
+    return static_cast<std::uint32_t>(get_pool().threads.size()) + 1;
+}
+
+void Renderer::parallel_for(std::uint32_t count, const std::function<void(std::uint32_t)>& task){
+    if (count == 0) return;
+
+    WorkerPool& pool = get_pool();
+    if (pool.threads.empty() || count == 1){
+        for (std::uint32_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    const std::uint32_t depth = job_depth + 1;
+    const std::uint32_t grain = std::max(1u, count / (worker_count() * 8));
+    std::atomic<std::uint32_t> remaining{count};
+
+    // keeps the lower half of the range and queues the upper half until it is down to grain
+    std::function<void(std::uint32_t, std::uint32_t)> run_range = [&](std::uint32_t begin, std::uint32_t end){
+        while (end - begin > grain){
+            const std::uint32_t middle = begin + (end - begin) / 2;
+            pool.push_job(Job{ .work = [&run_range, middle, end]{ run_range(middle, end); }, .depth = depth });
+            end = middle;
+        }
+        for (std::uint32_t i = begin; i < end; i++) task(i);
+        remaining.fetch_sub(end - begin, std::memory_order_release);
+    };
+
+    const std::uint32_t saved_depth = job_depth;
+    job_depth = depth;
+    run_range(0, count);
+    job_depth = saved_depth;
+    pool.wait(remaining, depth);
+}
+
+void Renderer::run_async(std::function<void()> work){
+    WorkerPool& pool = get_pool();
+    if (pool.threads.empty()){
+        work();
+        return;
+    }
+    // a waiting thread runs in a job of depth 0 or deeper and takes only jobs nested below it,
+    // so depth 0 is left to idle workers
+    pool.push_job(Job{ .work = std::move(work), .depth = 0 });
+}
+
+std::uint32_t Renderer::add_task(TaskGraph* graph, std::function<void()> work, const std::vector<std::uint32_t>& dependencies){
+    const std::uint32_t id = static_cast<std::uint32_t>(graph->tasks.size());
+    graph->tasks.push_back(TaskGraph::Task{ .work = std::move(work) });
+    for (const std::uint32_t dependency : dependencies){
+        graph->tasks[dependency].successors.push_back(id);
+        graph->tasks[id].dependency_count++;
+    }
+    return id;
+}
+
+void Renderer::run_task_graph(const TaskGraph& graph){
+    const std::uint32_t task_count = static_cast<std::uint32_t>(graph.tasks.size());
+    if (task_count == 0) return;
+
+    WorkerPool& pool = get_pool();
+    const std::uint32_t depth = job_depth + 1;
+    std::vector<std::atomic<std::uint32_t>> pending(task_count);
+    for (std::uint32_t i = 0; i < task_count; i++) pending[i].store(graph.tasks[i].dependency_count);
+    std::atomic<std::uint32_t> remaining{task_count};
+
+    // the last dependency to finish queues its successor
+    std::function<void(std::uint32_t)> run_task = [&](std::uint32_t id){
+        graph.tasks[id].work();
+        for (const std::uint32_t successor : graph.tasks[id].successors)
+            if (pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                pool.push_job(Job{ .work = [&run_task, successor]{ run_task(successor); }, .depth = depth });
+        remaining.fetch_sub(1, std::memory_order_release);
+    };
+
+    for (std::uint32_t i = 0; i < task_count; i++)
+        if (graph.tasks[i].dependency_count == 0)
+            pool.push_job(Job{ .work = [&run_task, i]{ run_task(i); }, .depth = depth });
+    pool.wait(remaining, depth);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Renderer{
+// work-stealing scheduler over a fixed pool of worker threads sized to the machine, shared by
+// every stage of the renderer. each worker keeps its own queue of jobs and takes jobs from the
+// others when it runs dry. a thread that waits for jobs it submitted runs queued jobs meanwhile,
+// so a pool of size 1 runs everything inline.
+std::uint32_t worker_count();
+
+// runs task(i) for every i in [0, count) and returns once all of them finished. the range is
+// split in halves until the pieces are small enough, idle workers steal the biggest pieces.
+// calls from inside a task are spread over the pool as well.
+void parallel_for(std::uint32_t count, const std::function<void(std::uint32_t)>& task);
+
+// queues work and returns right away. it is only picked up by workers that have nothing else to
+// do, never by a thread waiting in parallel_for, so long running work does not hold up a frame.
+// everything work uses has to outlive it. a pool of size 1 runs work inline.
+void run_async(std::function<void()> work);
+
+// tasks with dependencies, built up front and run with run_task_graph. a task starts once every
+// task it depends on finished, tasks without dependencies between them may run at the same time.
+struct TaskGraph{
+    struct Task{
+        std::function<void()> work;
+        std::vector<std::uint32_t> successors;
+        std::uint32_t dependency_count = 0;
+    };
+    std::vector<Task> tasks;
+};
+
+// returns the id of the new task, dependencies are ids returned earlier by add_task
+std::uint32_t add_task(TaskGraph* graph, std::function<void()> work, const std::vector<std::uint32_t>& dependencies = {});
+
+// runs every task of graph and returns once all of them finished
+void run_task_graph(const TaskGraph& graph);
+}
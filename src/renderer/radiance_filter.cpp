@@ -0,0 +1,146 @@
+#include "radiance_filter.hpp"
+#include "spherical_harmonics.hpp"
+#include "job_system.hpp"
+#include "glm/gtc/constants.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace Renderer;
+
+namespace {
+struct FilterSample{
+    glm::vec3 direction; // tangent space, z is the normal
+    float weight;        // n dot l
+    float lod;           // source mip to read it from
+};
+
+float radical_inverse(std::uint32_t bits){
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+// ggx lobe around n = v = r sampled with a hammersley set, as in the split sum approximation
+std::vector<FilterSample> create_sample_table(float roughness, std::uint32_t sample_count, std::uint32_t source_size){
+    const float a = roughness * roughness;
+    const float a2 = a * a;
+    const float texel_solid_angle = 4.f * glm::pi<float>() / (6.f * static_cast<float>(source_size * source_size));
+
+    std::vector<FilterSample> samples;
+    for (std::uint32_t i = 0; i < sample_count; i++){
+        const float xi_x = static_cast<float>(i) / static_cast<float>(sample_count);
+        const float xi_y = radical_inverse(i);
+        const float phi = 2.f * glm::pi<float>() * xi_x;
+        const float cos_theta = std::sqrt((1.f - xi_y) / (1.f + (a2 - 1.f) * xi_y));
+        const float sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+        const glm::vec3 h(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+        const glm::vec3 l = 2.f * h.z * h - glm::vec3(0.f, 0.f, 1.f);
+        if (l.z <= 0.f) continue;
+
+        // pdf of l is D(h) * (n dot h) / (4 (v dot h)), with n = v that is D(h) / 4
+        const float d = cos_theta * cos_theta * (a2 - 1.f) + 1.f;
+        const float pdf = a2 / (glm::pi<float>() * d * d) * 0.25f;
+        const float sample_solid_angle = 1.f / (static_cast<float>(sample_count) * pdf);
+        samples.push_back(FilterSample{
+            .direction = l,
+            .weight = l.z,
+            .lod = std::max(0.f, 0.5f * std::log2(sample_solid_angle / texel_solid_angle) + 1.f),
+        });
+    }
+    return samples;
+}
+
+glm::vec4 sample_bilinear(const Image<R8G8B8A8_U>& image, float x, float y){
+    x = std::clamp(x, 0.f, static_cast<float>(image.width - 1));
+    y = std::clamp(y, 0.f, static_cast<float>(image.height - 1));
+    const std::uint32_t x0 = static_cast<std::uint32_t>(x), y0 = static_cast<std::uint32_t>(y);
+    const std::uint32_t x1 = std::min(x0 + 1, image.width - 1), y1 = std::min(y0 + 1, image.height - 1);
+    const float fx = x - static_cast<float>(x0), fy = y - static_cast<float>(y0);
+    return (1.f - fy) * ((1.f - fx) * to_vec4(image.at(x0, y0)) + fx * to_vec4(image.at(x1, y0)))
+        + fy * ((1.f - fx) * to_vec4(image.at(x0, y1)) + fx * to_vec4(image.at(x1, y1)));
+}
+}
+
+glm::vec4 Renderer::sample_cube_map(const CubeMap& cube_map, const glm::vec3& direction, float lod){
+    // the face the direction is most in front of, clip w is the depth along the face's axis
+    std::uint32_t face = 0;
+    float max_w = -FLT_MAX;
+    for (std::uint32_t i = 0; i < 6; i++){
+        const glm::mat4& m = cube_map.view_proj[i];
+        const float w = m[0][3] * direction.x + m[1][3] * direction.y + m[2][3] * direction.z;
+        if (w > max_w){
+            max_w = w;
+            face = i;
+        }
+    }
+    const glm::vec4 clip = cube_map.view_proj[face] * glm::vec4(direction, 0.f);
+    const float u = (clip.x / clip.w + 1.f) * 0.5f, v = (1.f - clip.y / clip.w) * 0.5f;
+
+    const auto& mipmaps = cube_map.faces[face]->mipmaps;
+    const float max_lod = static_cast<float>(mipmaps.size() - 1);
+    lod = std::clamp(lod, 0.f, max_lod);
+    const std::uint32_t level = static_cast<std::uint32_t>(lod);
+    const float t = lod - static_cast<float>(level);
+
+    auto sample_level = [&](std::uint32_t level){
+        const Image<R8G8B8A8_U>& image = mipmaps[level];
+        return sample_bilinear(image, u * static_cast<float>(image.width) - 0.5f, v * static_cast<float>(image.height) - 0.5f);
+    };
+    const glm::vec4 color = sample_level(level);
+    if (t == 0.f) return color;
+    return glm::mix(color, sample_level(level + 1), t);
+}
+
+void Renderer::prefilter_radiance(std::array<Texture<R8G8B8A8_U>, 6>* faces, const std::array<glm::mat4, 6>& view_proj, std::uint32_t sample_count){
+    // the filter reads the box filtered chain while it overwrites the faces
+    const std::array<Texture<R8G8B8A8_U>, 6> source = *faces;
+    const CubeMap cube_map{
+        .faces = { &source[0], &source[1], &source[2], &source[3], &source[4], &source[5] },
+        .view_proj = view_proj,
+    };
+    std::array<glm::mat4, 6> inv_view_proj;
+    for (std::uint32_t i = 0; i < 6; i++) inv_view_proj[i] = glm::inverse(view_proj[i]);
+
+    const std::uint32_t mip_count = static_cast<std::uint32_t>(source[0].mipmaps.size());
+    if (mip_count < 2) return;
+    const std::uint32_t source_size = source[0].mipmaps[0].width;
+
+    // one table per mip, shared by the six faces
+    std::vector<std::vector<FilterSample>> tables(mip_count);
+    for (std::uint32_t mip = 1; mip < mip_count; mip++){
+        const float roughness = static_cast<float>(mip) / static_cast<float>(mip_count - 1);
+        tables[mip] = create_sample_table(roughness, sample_count, source_size);
+    }
+
+    // every row of every face of every mip is a task
+    std::vector<std::uint32_t> first_row(mip_count + 1, 0);
+    for (std::uint32_t mip = 1; mip < mip_count; mip++)
+        first_row[mip + 1] = first_row[mip] + 6 * source[0].mipmaps[mip].height;
+
+    parallel_for(first_row[mip_count], [&](std::uint32_t task){
+        const std::uint32_t mip = static_cast<std::uint32_t>(std::upper_bound(first_row.begin() + 1, first_row.end(), task) - first_row.begin()) - 1;
+        const std::uint32_t height = source[0].mipmaps[mip].height;
+        const std::uint32_t face = (task - first_row[mip]) / height, y = (task - first_row[mip]) % height;
+        Image<R8G8B8A8_U>& output = (*faces)[face].mipmaps[mip];
+
+        for (std::uint32_t x = 0; x < output.width; x++){
+            const glm::vec3 n = cube_texel_direction(inv_view_proj[face], x, y, output.width, output.height);
+            const glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(1.f, 0.f, 0.f);
+            const glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+            const glm::vec3 bitangent = glm::cross(n, tangent);
+
+            glm::vec4 sum(0.f);
+            float weight = 0.f;
+            for (const FilterSample& sample : tables[mip]){
+                const glm::vec3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+                sum += sample_cube_map(cube_map, l, sample.lod) * sample.weight;
+                weight += sample.weight;
+            }
+            output.at(x, y) = to_r8g8b8a8_u(weight > 0.f ? sum / weight : sample_cube_map(cube_map, n, static_cast<float>(mip)));
+        }
+    });
+}
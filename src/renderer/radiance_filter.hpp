@@ -0,0 +1,21 @@
+#pragma once
+
+#include "renderer.hpp"
+
+namespace Renderer{
+// six textures forming a cube, faces[i] rendered with view_proj[i]
+struct CubeMap{
+    std::array<const Texture<R8G8B8A8_U>*, 6> faces;
+    std::array<glm::mat4, 6> view_proj;
+};
+
+// trilinear lookup of the cube in a direction, seams are crossed by picking the face per direction
+glm::vec4 sample_cube_map(const CubeMap& cube_map, const glm::vec3& direction, float lod);
+
+// replaces mips 1 and up of every face with the radiance convolved with a GGX lobe of roughness
+// mip / (mip count - 1), mip 0 stays the mirror reflection. samples are importance sampled from
+// a direction table per mip shared by all faces, each one read from the source mip whose texels
+// match the solid angle it stands for (filtered importance sampling). the faces must already
+// hold a full mip chain, see generate_mipmaps.
+void prefilter_radiance(std::array<Texture<R8G8B8A8_U>, 6>* faces, const std::array<glm::mat4, 6>& view_proj, std::uint32_t sample_count = 64);
+}
@@ -1,4 +1,12 @@
 #include "renderer.hpp"
+#include "job_system.hpp"
+#include <memory>
+#include <bit>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace Renderer;
 
@@ -56,7 +64,23 @@ float Renderer::det(glm::vec2 const& a, glm::vec2 const& b) {
     return a.x * b.y - a.y * b.x;
 }
 
-Vertex clip_intersect_edge(Vertex const & v0, Vertex const & v1, float value0, float value1)
+// vertex of a triangle in the old draw path, decoded from the packed vertex and transformed
+struct ClipVertex {
+    glm::vec4 ndc_position;
+    glm::vec2 texcoord0;
+    glm::vec4 world_position;
+};
+
+ClipVertex get_clip_vertex(const DrawCall& command, std::uint32_t index)
+{
+    const PackedVertex& vertex = command.vertex_buffer->at(index);
+    return ClipVertex{
+        .texcoord0 = unpack_texcoord(vertex, command.quantization),
+        .world_position = command.world_transform * unpack_position(vertex, command.quantization),
+    };
+}
+
+ClipVertex clip_intersect_edge(ClipVertex const & v0, ClipVertex const & v1, float value0, float value1)
 {
     // f(t) = at+b
     // f(0) = v0 = b
@@ -66,7 +90,7 @@ Vertex clip_intersect_edge(Vertex const & v0, Vertex const & v1, float value0, f
 
     float t = value0 / (value0 - value1);
 
-    Vertex v;
+    ClipVertex v;
     v.ndc_position = (1.f - t) * v0.ndc_position + t * v1.ndc_position;
     // v.normal = (1.f - t) * v0.normal + t * v1.normal;
     v.texcoord0 = (1.f - t) * v0.texcoord0 + t * v1.texcoord0;
@@ -86,15 +110,18 @@ VertOut clip_intersect_edge(VertOut const & v0, VertOut const & v1, float value0
     float t = value0 / (value0 - value1);
 
     VertOut v;
+    v.model_pos = (1.f - t) * v0.model_pos + t * v1.model_pos;
     v.ndc_pos = (1.f - t) * v0.ndc_pos + t * v1.ndc_pos;
     // v.normal = (1.f - t) * v0.normal + t * v1.normal;
     v.texcoord = (1.f - t) * v0.texcoord + t * v1.texcoord;
     v.world_pos = (1.f - t) * v0.world_pos + t * v1.world_pos;
+    for (std::uint32_t i = 0; i < VARYING_COUNT; i++)
+        v.varyings[i] = (1.f - t) * v0.varyings[i] + t * v1.varyings[i];
 
     return v;
 }
 
-Vertex* clip_triangle(Vertex * triangle, glm::vec4 equation, Vertex * result)
+ClipVertex* clip_triangle(ClipVertex * triangle, glm::vec4 equation, ClipVertex * result)
 {
     float values[3] =
     {
@@ -189,102 +216,7 @@ Vertex* clip_triangle(Vertex * triangle, glm::vec4 equation, Vertex * result)
     return result;
 }
 
-VertOut* clip_triangle(VertOut * triangle, glm::vec4 equation, VertOut* result)
-{
-    float values[3] =
-    {
-        glm::dot(triangle[0].ndc_pos, equation),
-        glm::dot(triangle[1].ndc_pos, equation),
-        glm::dot(triangle[2].ndc_pos, equation),
-    };
-
-    std::uint8_t mask = (values[0] < 0.f ? 1 : 0) | (values[1] < 0.f ? 2 : 0) | (values[2] < 0.f ? 4 : 0);
-
-    switch (mask)
-    {
-    case 0b000:
-        // All vertices are inside allowed half-space
-        // No clipping required, copy the triangle to output
-        *result++ = triangle[0];
-        *result++ = triangle[1];
-        *result++ = triangle[2];
-        break;
-    case 0b001:
-        // Vertex 0 is outside allowed half-space
-        // Replace it with points on edges 01 and 02
-        // And re-triangulate
-        {
-            auto v01 = clip_intersect_edge(triangle[0], triangle[1], values[0], values[1]);
-            auto v02 = clip_intersect_edge(triangle[0], triangle[2], values[0], values[2]);
-            *result++ = v01;
-            *result++ = triangle[1];
-            *result++ = triangle[2];
-            *result++ = v01;
-            *result++ = triangle[2];
-            *result++ = v02;
-        }
-        break;
-    case 0b010:
-        // Vertex 1 is outside allowed half-space
-        // Replace it with points on edges 10 and 12
-        // And re-triangulate
-        {
-            auto v10 = clip_intersect_edge(triangle[1], triangle[0], values[1], values[0]);
-            auto v12 = clip_intersect_edge(triangle[1], triangle[2], values[1], values[2]);
-            *result++ = triangle[0];
-            *result++ = v10;
-            *result++ = triangle[2];
-            *result++ = triangle[2];
-            *result++ = v10;
-            *result++ = v12;
-        }
-        break;
-    case 0b011:
-        // Vertices 0 and 1 are outside allowed half-space
-        // Replace them with points on edges 02 and 12
-        *result++ = clip_intersect_edge(triangle[0], triangle[2], values[0], values[2]);
-        *result++ = clip_intersect_edge(triangle[1], triangle[2], values[1], values[2]);
-        *result++ = triangle[2];
-        break;
-    case 0b100:
-        // Vertex 2 is outside allowed half-space
-        // Replace it with points on edges 20 and 21
-        // And re-triangulate
-        {
-            auto v20 = clip_intersect_edge(triangle[2], triangle[0], values[2], values[0]);
-            auto v21 = clip_intersect_edge(triangle[2], triangle[1], values[2], values[1]);
-            *result++ = triangle[0];
-            *result++ = triangle[1];
-            *result++ = v20;
-            *result++ = v20;
-            *result++ = triangle[1];
-            *result++ = v21;
-        }
-        break;
-    case 0b101:
-        // Vertices 0 and 2 are outside allowed half-space
-        // Replace them with points on edges 01 and 21
-        *result++ = clip_intersect_edge(triangle[0], triangle[1], values[0], values[1]);
-        *result++ = triangle[1];
-        *result++ = clip_intersect_edge(triangle[2], triangle[1], values[2], values[1]);
-        break;
-    case 0b110:
-        // Vertices 1 and 2 are outside allowed half-space
-        // Replace them with points on edges 10 and 20
-        *result++ = triangle[0];
-        *result++ = clip_intersect_edge(triangle[1], triangle[0], values[1], values[0]);
-        *result++ = clip_intersect_edge(triangle[2], triangle[0], values[2], values[0]);
-        break;
-    case 0b111:
-        // All vertices are outside allowed half-space
-        // Clip the whole triangle, result is empty
-        break;
-    }
-
-    return result;
-}
-
-Renderer::Vertex* clip_triangle(Renderer::Vertex* begin, Renderer::Vertex* end)
+ClipVertex* clip_triangle(ClipVertex* begin, ClipVertex* end)
 {
     static glm::vec4 const equations[2] =
     {
@@ -292,13 +224,13 @@ Renderer::Vertex* clip_triangle(Renderer::Vertex* begin, Renderer::Vertex* end)
         {0.f, 0.f, -1.f, 1.f}, // Z <  W  => - Z + W > 0
     };
 
-    Vertex result[12];
+    ClipVertex result[12];
 
     for (auto equation : equations)
     {
         auto result_end = result;
 
-        for (Vertex* triangle = begin; triangle != end; triangle += 3)
+        for (ClipVertex* triangle = begin; triangle != end; triangle += 3)
             result_end = clip_triangle(triangle, equation, result_end);
 
         end = std::copy(result, result_end, begin);
@@ -307,21 +239,63 @@ Renderer::Vertex* clip_triangle(Renderer::Vertex* begin, Renderer::Vertex* end)
     return end;
 }
 
-Renderer::VertOut* clip_triangle(Renderer::VertOut* begin, Renderer::VertOut* end){
-    static glm::vec4 const equations[2] = {
-        {0.f, 0.f, 1.f, 1.f}, // Z > -W => Z + W > 0
-        {0.f, 0.f, -1.f, 1.f}, // Z < W => -Z + W > 0
+// a convex polygon gains at most one vertex per clip plane
+constexpr std::uint32_t MAX_CLIPPED_VERTICES = 3 + 6;
+
+// clip space half-spaces dot(ndc_pos, plane) >= 0: near, far, then the four sides of the guard band.
+// x and y are clipped against the guard band instead of the viewport, whatever is left outside the
+// screen is scissored by the rasterizer.
+using ClipPlanes = std::array<glm::vec4, 6>;
+
+ClipPlanes guard_band_clip_planes(float guard_band_x, float guard_band_y){
+    return {
+        glm::vec4(0.f, 0.f, 1.f, 1.f),            // z > -w
+        glm::vec4(0.f, 0.f, -1.f, 1.f),           // z < w
+        glm::vec4(1.f, 0.f, 0.f, guard_band_x),   // x > -guard_band_x * w
+        glm::vec4(-1.f, 0.f, 0.f, guard_band_x),  // x < guard_band_x * w
+        glm::vec4(0.f, 1.f, 0.f, guard_band_y),   // y > -guard_band_y * w
+        glm::vec4(0.f, -1.f, 0.f, guard_band_y),  // y < guard_band_y * w
     };
+}
 
-    VertOut result[12];
+// bit i is set when the vertex is outside planes[i]
+inline std::uint32_t clip_outcode(const glm::vec4& ndc_pos, const ClipPlanes& planes){
+    std::uint32_t outcode = 0;
+    for (std::uint32_t i = 0; i < planes.size(); i++)
+        if (glm::dot(ndc_pos, planes[i]) < 0.f) outcode |= 1u << i;
+    return outcode;
+}
 
-    for (auto equation : equations){
-        auto result_end = result;
-        for (VertOut* triangle = begin; triangle != end; triangle += 3)
-            result_end = clip_triangle(triangle, equation, result_end);
-        end = std::copy(result, result_end, begin);
+// sutherland-hodgman clipping of a triangle against the planes selected by plane_mask.
+// writes the resulting convex polygon to polygon and returns its vertex count, it can be
+// drawn as a fan around polygon[0] with the winding of the input triangle.
+std::uint32_t clip_polygon(const VertOut* triangle, const ClipPlanes& planes, std::uint32_t plane_mask, std::array<VertOut, MAX_CLIPPED_VERTICES>& polygon){
+    std::array<VertOut, MAX_CLIPPED_VERTICES> scratch;
+    VertOut* in = polygon.data();
+    VertOut* out = scratch.data();
+    std::copy(triangle, triangle + 3, in);
+    std::uint32_t count = 3;
+
+    for (std::uint32_t i = 0; i < planes.size() && count > 0; i++){
+        if (!((plane_mask >> i) & 1)) continue;
+
+        std::uint32_t out_count = 0;
+        for (std::uint32_t j = 0; j < count; j++){
+            const VertOut& v0 = in[j];
+            const VertOut& v1 = in[(j + 1) % count];
+            const float value0 = glm::dot(v0.ndc_pos, planes[i]);
+            const float value1 = glm::dot(v1.ndc_pos, planes[i]);
+            if (value0 >= 0.f) out[out_count++] = v0;
+            // always interpolate from the inside vertex so triangles sharing the edge get the same point
+            if ((value0 >= 0.f) != (value1 >= 0.f))
+                out[out_count++] = value0 >= 0.f ? clip_intersect_edge(v0, v1, value0, value1) : clip_intersect_edge(v1, v0, value1, value0);
+        }
+        std::swap(in, out);
+        count = out_count;
     }
-    return end;
+
+    if (in != polygon.data()) std::copy(in, in + count, polygon.data());
+    return count;
 }
 
 inline glm::vec4 perspective_divide(glm::vec4 const& v) {
@@ -387,45 +361,37 @@ inline bool cull_triangle_by_world_aabb(
 }
 
 
+float Renderer::shadow_value(const ShadowCascades* shadows, const glm::vec4& light_space_pos){
+    if (!shadows) return 0.f;
+
+    for (std::uint32_t i = 0; i < shadows->count; i++){
+        const ShadowCascade& cascade = shadows->cascades[i];
+        glm::vec4 pos = cascade.proj * light_space_pos;
+        pos /= pos.w;
+
+        const float u = pos.x * 0.5f + 0.5f, v = -pos.y * 0.5f + 0.5f;
+        if (u < 0.f || u >= 1.f || v < 0.f || v >= 1.f) continue;
+
+        const Image<std::uint32_t>& depth_map = *cascade.depth_map;
+        const std::uint32_t x = std::min(depth_map.width - 1, static_cast<std::uint32_t>(u * static_cast<float>(depth_map.width)));
+        const std::uint32_t y = std::min(depth_map.height - 1, static_cast<std::uint32_t>(v * static_cast<float>(depth_map.height)));
+        const float closest_distance = static_cast<float>(depth_map.at(x, y)) / UINT32_MAX;
+        const float current_distance = pos.z * 0.5f + 0.5f;
+        return current_distance - 0.005f > closest_distance ? 1.f : 0.f;
+    }
+    return 0.f;
+}
+
 VertOut Renderer::vertex_shader(const VertIn& in, const Uniform& uniform){
 	glm::vec4 world_pos = uniform.model_mat * in.model_pos;
 	glm::vec4 ndc_pos = uniform.proj_view_mat * world_pos;
-	return VertOut {
+	VertOut out {
 		.model_pos = in.model_pos,
 		.world_pos = world_pos,
 		.ndc_pos = ndc_pos,
 		.texcoord = in.texcoord,
 	};
-}
-
-FragOut Renderer::fragment_shader(const FragIn& in, const Uniform& uniform, const std::function<glm::vec4(Texture<R8G8B8A8_U>*)> samplet_tex0) {
-	FragOut out{
-		.color = glm::vec4(1.f, 1.f, 1.f, 1.f),
-        .depth = 0,
-	};
-
-    auto light_space_pos = uniform.light_mat * in.world_pos;
-    light_space_pos /= light_space_pos.w;
-    auto closest_distance = static_cast<float>(uniform.shadow_map->at(static_cast<std::uint32_t>((light_space_pos.x * 0.5f + 0.5f) * 2048), static_cast<std::uint32_t>((-light_space_pos.y * 0.5f + 0.5f) * 2048))) / UINT32_MAX;
-    auto current_distance = light_space_pos.z * 0.5f + 0.5f;
-    float shadow_value = current_distance - 0.005f > closest_distance ? 1.f : 0.f;
-
-    auto light_direction = glm::normalize(glm::vec4(0.f, 0.f, -1.f, 0.f));
-    auto light_normal = glm::normalize(uniform.light_mat * glm::vec4(in.world_norm, 0.f));
-
-    auto light_dot = glm::dot(light_direction, light_normal);
-    if (light_dot < 0.f) light_dot = 0.f;
-    // light_dot = light_dot * 0.5f + 0.5f;
-
-    auto light_intensity =  light_dot;
-
-    glm::vec4 albedo = glm::vec4(uniform.material->diffuse, 1.f);
-    if (uniform.material->diffuse_tex)
-        albedo = samplet_tex0(uniform.material->diffuse_tex);
-    
-    auto light_diffuse = glm::vec4(1.f) * (1.f - shadow_value) * albedo / 3.14f * light_intensity;
-    out.color = light_diffuse;
-
+    set_varying_vec4(&out, VARYING_LIGHT_SPACE_POS, uniform.light_mat * world_pos);
     return out;
 }
 
@@ -437,27 +403,10 @@ void Renderer::draw(FrameBuffer* frame_buffer, const DrawCall& command, const Vi
         const std::uint32_t i1 = command.index_buffer->at(idx_idx + 1);
         const std::uint32_t i2 = command.index_buffer->at(idx_idx + 2);
 
-        const Vertex v0 = command.vertex_buffer->at(i0);
-        const Vertex v1 = command.vertex_buffer->at(i1);
-        const Vertex v2 = command.vertex_buffer->at(i2);
-
-        for (std::uint32_t i = 0; i < 3; i++){
-            const std::uint32_t idx = command.index_buffer->at(idx_idx + i);
-            const Vertex& vert = command.vertex_buffer->at(idx);
-            const VertIn vert_input {
-                .model_pos = glm::vec4(v0.world_position),
-                .texcoord = vert.texcoord0,
-            };
-        }
-
-        Vertex vertices[12];
-        vertices[0] = command.vertex_buffer->at(i0);
-        vertices[1] = command.vertex_buffer->at(i1);
-        vertices[2] = command.vertex_buffer->at(i2);
-
-        vertices[0].world_position = command.world_transform * vertices[0].world_position;
-        vertices[1].world_position = command.world_transform * vertices[1].world_position;
-        vertices[2].world_position = command.world_transform * vertices[2].world_position;
+        ClipVertex vertices[12];
+        vertices[0] = get_clip_vertex(command, i0);
+        vertices[1] = get_clip_vertex(command, i1);
+        vertices[2] = get_clip_vertex(command, i2);
 
         
         if (cull_triangle_by_world_aabb(vertices[0].world_position, vertices[1].world_position, vertices[2].world_position, frustum))
@@ -473,9 +422,9 @@ void Renderer::draw(FrameBuffer* frame_buffer, const DrawCall& command, const Vi
         auto end = clip_triangle(vertices, vertices + 3);
 
         for (auto triangle_begin = vertices; triangle_begin < end; triangle_begin += 3){
-            Vertex v0 = triangle_begin[0];
-            Vertex v1 = triangle_begin[1];
-            Vertex v2 = triangle_begin[2];
+            ClipVertex v0 = triangle_begin[0];
+            ClipVertex v1 = triangle_begin[1];
+            ClipVertex v2 = triangle_begin[2];
             
             v0.ndc_position = perspective_divide(v0.ndc_position);
             v1.ndc_position = perspective_divide(v1.ndc_position);
@@ -646,26 +595,18 @@ void Renderer::draw(FrameBuffer* frame_buffer, const DrawCall& command, const Vi
                                     color = glm::vec4(command.material->diffuse, 1.f);
                                 }
 
-                                auto light_space_pos = command.light_mat * world_position;
-                                light_space_pos /= light_space_pos.w;
-                                auto closest_distance = static_cast<float>(command.shadow_map->at(static_cast<std::uint32_t>((light_space_pos.x * 0.5f + 0.5f) * 2048), static_cast<std::uint32_t>((-light_space_pos.y * 0.5f + 0.5f) * 2048))) / UINT32_MAX;
-                                // std::cout << closest_distance << "\n";
-                                auto current_distance = light_space_pos.z * 0.5f + 0.5f;
-                                float shadow_value = current_distance - 0.005f > closest_distance ? 1.f : 0.f;
-
-                                auto light_direction = glm::normalize(glm::vec4(0.f, 0.f, -1.f, 0.f));
-                                auto light_normal = glm::normalize(command.light_mat * glm::vec4(world_normal, 0.f));
+                                float shadow = Renderer::shadow_value(command.shadows, command.light_mat * world_position);
 
-                                auto light_dot = glm::dot(light_direction, light_normal);
+                                auto light_dot = glm::dot(-command.light_direction, glm::normalize(world_normal));
                                 if (light_dot < 0.f) light_dot = 0.f;
                                 // light_dot = light_dot * 0.5f + 0.5f;
 
                                 auto light_intensity =  light_dot;
                                 
-                                auto light_diffuse = glm::vec4(1.f) * (1.f - shadow_value) * color / 3.14f * light_intensity;
+                                auto light_diffuse = glm::vec4(1.f) * (1.f - shadow) * color / 3.14f * light_intensity;
 
 
-                                frame_buffer->color_buffer_view->at(x + dx, y + dy) = to_r8g8b8a8_u(color * (1.f - shadow_value) * glm::vec4(light_intensity));
+                                frame_buffer->color_buffer_view->at(x + dx, y + dy) = to_r8g8b8a8_u(color * (1.f - shadow) * glm::vec4(light_intensity));
                             }
                         }
                     }
@@ -675,37 +616,14 @@ void Renderer::draw(FrameBuffer* frame_buffer, const DrawCall& command, const Vi
             }
         }
     }
-}
-
-using array2x2 = std::array<std::array<float, 2>, 2>;
-void culc_bary_centric(
-    array2x2* det01p, array2x2* det12p, array2x2* det20p, 
-    array2x2* l0, array2x2* l1, array2x2* l2, 
-    const glm::vec4& v0ndc, const glm::vec4& v1ndc, const glm::vec4& v2ndc,
-    const std::uint32_t x, const std::uint32_t y, const float det012){
-    for (int dy = 0; dy < 2; dy++){
-        for (int dx = 0; dx < 2; dx++){
-            glm::vec4 p = glm::vec4( x+dx+0.5f, y+dy+0.5f, 0.f, 0.f);
-
-            det01p->at(dy).at(dx) = det(v1ndc - v0ndc, p - v0ndc);
-            det12p->at(dy).at(dx) = det(v2ndc - v1ndc, p - v1ndc);
-            det20p->at(dy).at(dx) = det(v0ndc - v2ndc, p - v2ndc);
-
-            l0->at(dy).at(dx) = det12p->at(dy).at(dx) / det012 * v0ndc.w;
-            l1->at(dy).at(dx) = det20p->at(dy).at(dx) / det012 * v1ndc.w;
-            l2->at(dy).at(dx) = det01p->at(dy).at(dx) / det012 * v2ndc.w;
-
-            float lsum = l0->at(dy).at(dx) + l1->at(dy).at(dx) + l2->at(dy).at(dx);
 
-            l0->at(dy).at(dx) /= lsum;
-            l1->at(dy).at(dx) /= lsum;
-            l2->at(dy).at(dx) /= lsum;
-        }
+    // this path does not track the depth it writes, so hi-z falls back to not rejecting anything
+    if (frame_buffer->hiz_buffer && command.depth_settings.write){
+        std::fill(frame_buffer->hiz_buffer->blocks.image.begin(), frame_buffer->hiz_buffer->blocks.image.end(), UINT32_MAX);
+        std::fill(frame_buffer->hiz_buffer->tiles.image.begin(), frame_buffer->hiz_buffer->tiles.image.end(), UINT32_MAX);
     }
 }
 
-
-
 Image<R8G8B8A8_U>* select_mipmap(Texture<R8G8B8A8_U>* texture, float texel_area){
     bool magnification = texel_area >= 1.f;
 
@@ -744,40 +662,153 @@ glm::vec4 sample_texture_at(Image<R8G8B8A8_U>* mipmap, glm::vec2 texcoord) {
     }
 }
 
-void draw_triangle(FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport, FragIn v0, FragIn v1, FragIn v2){
-    Uniform uniform = {
-        .model_mat = command.world_transform,
-        .proj_view_mat = command.vp_transform,
-        .light_mat = command.light_mat,
-        .light_dir = command.light_direction,
-        .material = command.material,
-        .shadow_map = command.shadow_map,
+// samples tex with the mip level picked from the texcoord derivatives of the pixel
+glm::vec4 sample_texture(Texture<R8G8B8A8_U>* tex, glm::vec2 texcoord, glm::vec2 texcoord_dx, glm::vec2 texcoord_dy){
+    if (!tex) return glm::vec4(0.f);
+    glm::vec2 texture_scale(tex->mipmaps[0].width, tex->mipmaps[0].height);
+    glm::vec2 tc = texture_scale * texcoord;
+    glm::vec2 tc_dx = texture_scale * texcoord_dx;
+    glm::vec2 tc_dy = texture_scale * texcoord_dy;
+    float texel_area = 1.f / std::abs(det(tc_dx, tc_dy));
+    auto mipmap = select_mipmap(tex, texel_area);
+    tc.x = static_cast<float>(fmod(tc.x, mipmap->width)); 
+    if (tc.x < 0.f) tc.x += mipmap->width;
+    tc.y = static_cast<float>(fmod(tc.y, mipmap->height));
+    if (tc.y < 0.f) tc.y += mipmap->height;    
+    return sample_texture_at(mipmap, tc);
+}
+
+// vertices are snapped to a fixed-point grid with SUBPIXEL_BITS fractional bits and the
+// edge functions are evaluated exactly in 64-bit integers. coordinates are clamped to
+// +-MAX_SNAP_COORD pixels so the edge function products cannot overflow.
+constexpr std::int32_t SUBPIXEL_BITS = 8;
+constexpr std::int64_t SUBPIXEL_SCALE = std::int64_t(1) << SUBPIXEL_BITS;
+constexpr float MAX_SNAP_COORD = static_cast<float>(1 << 21);
+
+// triangles that stay within GUARD_BAND_COORD pixels of the viewport are rasterized without
+// clipping in x and y. it leaves room below MAX_SNAP_COORD for the viewport offset and size.
+constexpr float GUARD_BAND_COORD = static_cast<float>(1 << 20);
+
+struct EdgeFunction{
+    std::int64_t origin; // value at the center of pixel (xmin, ymin)
+    std::int64_t step_x; // change per pixel in x
+    std::int64_t step_y; // change per pixel in y
+    std::int64_t bias;   // 1 for top-left edges so pixels exactly on them are covered, 0 otherwise
+};
+
+// far plane depth is clamped to the largest float below 2^32 so the conversion never overflows
+constexpr float MAX_DEPTH_VALUE = 4294967040.f;
+
+// depth buffer value of an ndc depth, before rounding
+inline float to_depth_units(float ndc_z){
+    return (0.5f + 0.5f * ndc_z) * static_cast<float>(UINT32_MAX);
+}
+
+inline std::uint32_t quantize_depth(float depth){
+    return static_cast<std::uint32_t>(std::clamp(depth, 0.f, MAX_DEPTH_VALUE));
+}
+
+inline std::uint32_t to_depth(float ndc_z){
+    return quantize_depth(to_depth_units(ndc_z));
+}
+
+// a + b * x + c * y, with x and y in pixels from the center of pixel (xmin, ymin) of the triangle
+struct AttributePlane{
+    float a, b, c;
+};
+
+// FragIn components interpolated through planes of attribute / w
+constexpr std::uint32_t ATTRIBUTE_MODEL_POS = 0;
+constexpr std::uint32_t ATTRIBUTE_WORLD_POS = 4;
+constexpr std::uint32_t ATTRIBUTE_TEXCOORD = 8;
+constexpr std::uint32_t ATTRIBUTE_VARYINGS = 10;
+constexpr std::uint32_t ATTRIBUTE_COUNT = ATTRIBUTE_VARYINGS + VARYING_COUNT;
+
+// what the raster stage needs to find covered pixels and their depth. it is all a depth only
+// draw sets up and bins. z / w is linear in screen space, so depth is a plane of its own.
+struct TriangleSetup{
+    std::array<EdgeFunction, 3> edges; // edges[i] is the edge opposite to vertex i
+    std::int32_t xmin, xmax, ymin, ymax;
+    float min_depth; // nearest depth of the triangle in depth buffer units
+    std::uint32_t triangle_id = 0; // index of the source triangle in the draw's index buffer
+    AttributePlane depth; // in depth buffer units
+};
+
+// interpolated fragment attributes, only set up for draws that run the fragment shader.
+// pixels evaluate the planes of attribute / w and 1 / w and do a single division.
+struct TriangleAttributes{
+    glm::vec3 world_norm;
+    AttributePlane inv_w;
+    std::array<AttributePlane, ATTRIBUTE_COUNT> attributes;
+};
+
+struct Rect{
+    std::int32_t x0, y0, x1, y1; // [x0, x1) x [y0, y1)
+};
+
+inline std::int64_t snap_to_subpixel(float v){
+    return std::llround(std::clamp(v, -MAX_SNAP_COORD, MAX_SNAP_COORD) * static_cast<float>(SUBPIXEL_SCALE));
+}
+
+// edge function of a -> b, positive on the inside of a clock wise (screen space, y down) triangle
+inline EdgeFunction setup_edge(std::int64_t ax, std::int64_t ay, std::int64_t bx, std::int64_t by, std::int32_t xmin, std::int32_t ymin){
+    const std::int64_t dx = bx - ax;
+    const std::int64_t dy = by - ay;
+    const std::int64_t px = (static_cast<std::int64_t>(xmin) << SUBPIXEL_BITS) + SUBPIXEL_SCALE / 2;
+    const std::int64_t py = (static_cast<std::int64_t>(ymin) << SUBPIXEL_BITS) + SUBPIXEL_SCALE / 2;
+    const bool is_top_left = (dy == 0 && dx > 0) || dy < 0;
+    return EdgeFunction{
+        .origin = dx * (py - ay) - dy * (px - ax),
+        .step_x = -dy * SUBPIXEL_SCALE,
+        .step_y = dx * SUBPIXEL_SCALE,
+        .bias = is_top_left ? 1 : 0,
     };
+}
 
+inline std::array<float, ATTRIBUTE_COUNT> get_attributes(const FragIn& v){
+    std::array<float, ATTRIBUTE_COUNT> attributes;
+    for (int c = 0; c < 4; c++){
+        attributes[ATTRIBUTE_MODEL_POS + c] = v.model_pos[c];
+        attributes[ATTRIBUTE_WORLD_POS + c] = v.world_pos[c];
+    }
+    attributes[ATTRIBUTE_TEXCOORD + 0] = v.texcoord.x;
+    attributes[ATTRIBUTE_TEXCOORD + 1] = v.texcoord.y;
+    for (std::uint32_t i = 0; i < VARYING_COUNT; i++) attributes[ATTRIBUTE_VARYINGS + i] = v.varyings[i];
+    return attributes;
+}
+
+// attributes is only filled in when it is not null
+std::optional<TriangleSetup> setup_triangle(const FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport, FragIn v0, FragIn v1, FragIn v2, TriangleAttributes* attributes){
     v0.ndc_pos = apply(viewport, perspective_divide(v0.ndc_pos));
     v1.ndc_pos = apply(viewport, perspective_divide(v1.ndc_pos));
     v2.ndc_pos = apply(viewport, perspective_divide(v2.ndc_pos));
 
-    float det012 = det(v1.ndc_pos.xy - v0.ndc_pos.xy, v2.ndc_pos.xy - v0.ndc_pos.xy);
+    std::array<std::int64_t, 3> fx = {snap_to_subpixel(v0.ndc_pos.x), snap_to_subpixel(v1.ndc_pos.x), snap_to_subpixel(v2.ndc_pos.x)};
+    std::array<std::int64_t, 3> fy = {snap_to_subpixel(v0.ndc_pos.y), snap_to_subpixel(v1.ndc_pos.y), snap_to_subpixel(v2.ndc_pos.y)};
+
+    const std::int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+    if (area == 0) return std::nullopt;
 
-    const bool is_ccw = det012 < 0.f;
+    const bool is_ccw = area < 0;
+    bool swap_winding = false;
     switch(command.cull_mode){
     case CullMode::NONE:
-        if(is_ccw){
-            std::swap(v1, v2);
-            det012 = -det012;
-        }
+        swap_winding = is_ccw;
         break;
     case CullMode::CLOCK_WISE:
-        if (!is_ccw) return;
-        std::swap(v1, v2);
-        det012 = -det012;
+        if (!is_ccw) return std::nullopt;
+        swap_winding = true;
         break;
     case CullMode::COUNTER_CLOCK_WISE:
-        if (is_ccw) return;
+        if (is_ccw) return std::nullopt;
         break;
     default: break;
     }
+    if (swap_winding){
+        std::swap(v1, v2);
+        std::swap(fx[1], fx[2]);
+        std::swap(fy[1], fy[2]);
+    }
 
     std::int32_t xmin = std::max<std::int32_t>(viewport.x, 0);
     std::int32_t xmax = std::min<std::int32_t>(viewport.x + viewport.width, get_width(frame_buffer))-1;
@@ -809,108 +840,1043 @@ void draw_triangle(FrameBuffer* frame_buffer, const DrawCall& command, const Vie
             std::ceil(v1.ndc_pos.y), 
             std::ceil(v2.ndc_pos.y)})));
 
-    for (std::int32_t y = ymin; y < ymax; y+= 2)
-    for (std::int32_t x = xmin; x < xmax; x+= 2){
-        array2x2 det01p;
-        array2x2 det12p;
-        array2x2 det20p;
-
-        array2x2 l0;
-        array2x2 l1;
-        array2x2 l2;
-
-        culc_bary_centric(&det01p, &det12p, &det20p, &l0, &l1, &l2, v0.ndc_pos, v1.ndc_pos, v2.ndc_pos, x, y, det012);
-
-        std::array<std::array<FragIn, 2>, 2> vertices{};
-        for (int dy = 0; dy < 2; dy++)
-        for (int dx = 0; dx < 2; dx++){
-            if (x + dx > xmax || y + dy > ymax) continue;
-            if (det01p[dy][dx] < 0.f || det12p[dy][dx] < 0.f || det20p[dy][dx] < 0.f) continue;
-
-            vertices[dy][dx] = FragIn{
-                .model_pos = l0[dy][dx] * v0.model_pos + l1[dy][dx] * v1.model_pos + l2[dy][dx] * v2.model_pos,
-                .world_pos = l0[dy][dx] * v0.world_pos + l1[dy][dx] * v1.world_pos + l2[dy][dx] * v2.world_pos,
-                .world_norm = glm::cross( v2.world_pos.xyz - v0.world_pos.xyz, v1.world_pos.xyz - v0.world_pos.xyz),
-                .ndc_pos = l0[dy][dx] * v0.ndc_pos + l1[dy][dx] * v1.ndc_pos + l2[dy][dx] * v2.ndc_pos,
-                .texcoord = l0[dy][dx] * v0.texcoord + l1[dy][dx] * v1.texcoord + l2[dy][dx] * v2.texcoord,
-            };
+    if (xmin >= xmax || ymin >= ymax) return std::nullopt;
+
+    TriangleSetup setup{
+        .edges = {
+            setup_edge(fx[1], fy[1], fx[2], fy[2], xmin, ymin),
+            setup_edge(fx[2], fy[2], fx[0], fy[0], xmin, ymin),
+            setup_edge(fx[0], fy[0], fx[1], fy[1], xmin, ymin),
+        },
+        .xmin = xmin, .xmax = xmax, .ymin = ymin, .ymax = ymax,
+        .min_depth = to_depth_units(std::min({v0.ndc_pos.z, v1.ndc_pos.z, v2.ndc_pos.z})),
+    };
+
+    // barycentric weight of vertex k is edges[k] / sum of the edges, which is constant (twice the area).
+    // gradients are computed in double, the edge values can be far larger than a float holds exactly.
+    const double inv_edge_sum = 1.0 / static_cast<double>(setup.edges[0].origin + setup.edges[1].origin + setup.edges[2].origin);
+    std::array<glm::dvec3, 3> weights;
+    for (int k = 0; k < 3; k++){
+        const EdgeFunction& edge = setup.edges[k];
+        weights[k] = glm::dvec3(static_cast<double>(edge.origin), static_cast<double>(edge.step_x), static_cast<double>(edge.step_y)) * inv_edge_sum;
+    }
+    auto setup_plane = [&weights](float q0, float q1, float q2){
+        const glm::dvec3 plane = weights[0] * static_cast<double>(q0) + weights[1] * static_cast<double>(q1) + weights[2] * static_cast<double>(q2);
+        return AttributePlane{static_cast<float>(plane.x), static_cast<float>(plane.y), static_cast<float>(plane.z)};
+    };
+
+    setup.depth = setup_plane(to_depth_units(v0.ndc_pos.z), to_depth_units(v1.ndc_pos.z), to_depth_units(v2.ndc_pos.z));
+    if (attributes){
+        attributes->world_norm = glm::cross(v2.world_pos.xyz - v0.world_pos.xyz, v1.world_pos.xyz - v0.world_pos.xyz);
+        attributes->inv_w = setup_plane(v0.ndc_pos.w, v1.ndc_pos.w, v2.ndc_pos.w);
+        const auto a0 = get_attributes(v0), a1 = get_attributes(v1), a2 = get_attributes(v2);
+        for (std::uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+            attributes->attributes[i] = setup_plane(a0[i] * v0.ndc_pos.w, a1[i] * v1.ndc_pos.w, a2[i] * v2.ndc_pos.w);
+    }
+    return setup;
+}
+
+// 2x2 pixel quad. lanes are ordered (x, y), (x + 1, y), (x, y + 1), (x + 1, y + 1).
+struct Quad{
+    std::uint32_t coverage; // bit i is set when lane i is inside the triangle
+    std::array<FragIn, 4> fragments; // uncovered lanes are interpolated too, they take part in texcoord derivatives
+    alignas(16) std::array<float, 4> depth; // in depth buffer units, before rounding
+};
+
+inline float evaluate(const AttributePlane& plane, float x, float y){
+    return plane.a + plane.b * x + plane.c * y;
+}
+
+// fills a fragment from its perspective corrected attributes, stride apart in values
+inline void set_fragment(FragIn* frag, const float* values, std::uint32_t stride, const glm::vec3& world_norm, float x, float y, float depth, float inv_w){
+    auto at = [values, stride](std::uint32_t i){ return values[i * stride]; };
+    frag->model_pos = glm::vec4(at(ATTRIBUTE_MODEL_POS + 0), at(ATTRIBUTE_MODEL_POS + 1), at(ATTRIBUTE_MODEL_POS + 2), at(ATTRIBUTE_MODEL_POS + 3));
+    frag->world_pos = glm::vec4(at(ATTRIBUTE_WORLD_POS + 0), at(ATTRIBUTE_WORLD_POS + 1), at(ATTRIBUTE_WORLD_POS + 2), at(ATTRIBUTE_WORLD_POS + 3));
+    frag->world_norm = world_norm;
+    frag->ndc_pos = glm::vec4(x + 0.5f, y + 0.5f, depth / static_cast<float>(UINT32_MAX) * 2.f - 1.f, inv_w);
+    frag->texcoord = glm::vec2(at(ATTRIBUTE_TEXCOORD + 0), at(ATTRIBUTE_TEXCOORD + 1));
+    for (std::uint32_t i = 0; i < VARYING_COUNT; i++) frag->varyings[i] = at(ATTRIBUTE_VARYINGS + i);
+}
+
+inline std::uint32_t quad_bounds_mask(const TriangleSetup& tri, std::int32_t x, std::int32_t y){
+    std::uint32_t mask = 0b1111;
+    if (x + 1 > tri.xmax) mask &= 0b0101;
+    if (y + 1 > tri.ymax) mask &= 0b0011;
+    return mask;
+}
+
+// scalar kernels, kept as the reference the SIMD kernels are validated against
+
+std::uint32_t quad_coverage_scalar(const TriangleSetup& tri, const std::array<std::int64_t, 3>& quad_edges){
+    std::uint32_t coverage = 0;
+    for (std::uint32_t lane = 0; lane < 4; lane++){
+        const std::int64_t dx = lane & 1, dy = lane >> 1;
+        bool covered = true;
+        for (int k = 0; k < 3; k++)
+            covered = covered && quad_edges[k] + dx * tri.edges[k].step_x + dy * tri.edges[k].step_y + tri.edges[k].bias > 0;
+        if (covered) coverage |= 1u << lane;
+    }
+    return coverage;
+}
+
+// depth of the quad at pixel (x, y), the only value a depth only draw interpolates
+void interpolate_depth_scalar(const TriangleSetup& tri, std::int32_t x, std::int32_t y, Quad* quad){
+    const float fx = static_cast<float>(x - tri.xmin), fy = static_cast<float>(y - tri.ymin);
+    for (std::uint32_t lane = 0; lane < 4; lane++)
+        quad->depth[lane] = evaluate(tri.depth, fx + static_cast<float>(lane & 1), fy + static_cast<float>(lane >> 1));
+}
+
+// attributes of the quad at pixel (x, y), after its depth
+void interpolate_quad_scalar(const TriangleSetup& tri, const TriangleAttributes& attributes, std::int32_t x, std::int32_t y, Quad* quad){
+    const float fx = static_cast<float>(x - tri.xmin), fy = static_cast<float>(y - tri.ymin);
+
+    for (std::uint32_t lane = 0; lane < 4; lane++){
+        const float px = fx + static_cast<float>(lane & 1), py = fy + static_cast<float>(lane >> 1);
+        const float inv_w = evaluate(attributes.inv_w, px, py);
+        const float w = 1.f / inv_w;
+
+        std::array<float, ATTRIBUTE_COUNT> values;
+        for (std::uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+            values[i] = evaluate(attributes.attributes[i], px, py) * w;
+
+        set_fragment(&quad->fragments[lane], values.data(), 1, attributes.world_norm,
+            static_cast<float>(x + static_cast<std::int32_t>(lane & 1)), static_cast<float>(y + static_cast<std::int32_t>(lane >> 1)), quad->depth[lane], inv_w);
+    }
+}
+
+// depth test with the comparison fixed at compile time
+template<DepthTestMode DEPTH_TEST>
+inline bool depth_test(std::uint32_t value, std::uint32_t reference){
+    if constexpr (DEPTH_TEST == DepthTestMode::ALWAYS) return true;
+    else if constexpr (DEPTH_TEST == DepthTestMode::LESS) return value < reference;
+    else if constexpr (DEPTH_TEST == DepthTestMode::LESSEQUAL) return value <= reference;
+    else if constexpr (DEPTH_TEST == DepthTestMode::GREATER) return value > reference;
+    else if constexpr (DEPTH_TEST == DepthTestMode::GREATEREQUAL) return value >= reference;
+    else if constexpr (DEPTH_TEST == DepthTestMode::EQUAL) return value == reference;
+    else if constexpr (DEPTH_TEST == DepthTestMode::NOTEQUAL) return value != reference;
+    else return false;
+}
+
+template<DepthTestMode DEPTH_TEST, bool DEPTH_WRITE>
+std::uint32_t depth_test_quad_scalar(ImageView<std::uint32_t>* depth_buffer, const Quad& quad, std::uint32_t mask, std::int32_t x, std::int32_t y){
+    std::uint32_t passed = 0;
+    for (std::uint32_t lane = 0; lane < 4; lane++){
+        if (!((mask >> lane) & 1)) continue;
+        std::uint32_t& reference = depth_buffer->at(x + (lane & 1), y + (lane >> 1));
+        const std::uint32_t depth = quantize_depth(quad.depth[lane]);
+        if (!depth_test<DEPTH_TEST>(depth, reference)) continue;
+        if constexpr (DEPTH_WRITE) reference = depth;
+        passed |= 1u << lane;
+    }
+    return passed;
+}
+
+#if defined(__AVX2__)
+// SIMD kernels. coverage is tested on the exact 64 bit edge values, attributes are
+// interpolated one component per register across the 4 lanes, and the depth test is a
+// vector compare followed by a masked store of both quad rows.
+
+inline std::uint32_t quad_coverage_simd(const TriangleSetup& tri, const std::array<std::int64_t, 3>& quad_edges){
+    __m256i inside = _mm256_set1_epi64x(-1);
+    for (int k = 0; k < 3; k++){
+        const EdgeFunction& edge = tri.edges[k];
+        const __m256i lane_offsets = _mm256_setr_epi64x(0, edge.step_x, edge.step_y, edge.step_x + edge.step_y);
+        const __m256i e = _mm256_add_epi64(_mm256_set1_epi64x(quad_edges[k] + edge.bias), lane_offsets);
+        inside = _mm256_and_si256(inside, _mm256_cmpgt_epi64(e, _mm256_setzero_si256()));
+    }
+    return static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(inside)));
+}
+
+// pixel coordinates of the quad lanes relative to the triangle, in the same operation order as
+// the scalar kernels so both paths produce the same values
+struct QuadPosition{
+    __m128 x, y;
+};
+
+inline QuadPosition quad_position(const TriangleSetup& tri, std::int32_t x, std::int32_t y){
+    return QuadPosition{
+        .x = _mm_add_ps(_mm_set1_ps(static_cast<float>(x - tri.xmin)), _mm_setr_ps(0.f, 1.f, 0.f, 1.f)),
+        .y = _mm_add_ps(_mm_set1_ps(static_cast<float>(y - tri.ymin)), _mm_setr_ps(0.f, 0.f, 1.f, 1.f)),
+    };
+}
+
+inline __m128 evaluate_lanes(const AttributePlane& plane, const QuadPosition& p){
+    return _mm_add_ps(_mm_add_ps(_mm_set1_ps(plane.a), _mm_mul_ps(_mm_set1_ps(plane.b), p.x)), _mm_mul_ps(_mm_set1_ps(plane.c), p.y));
+}
+
+void interpolate_depth_simd(const TriangleSetup& tri, std::int32_t x, std::int32_t y, Quad* quad){
+    _mm_store_ps(quad->depth.data(), evaluate_lanes(tri.depth, quad_position(tri, x, y)));
+}
+
+void interpolate_quad_simd(const TriangleSetup& tri, const TriangleAttributes& attributes, std::int32_t x, std::int32_t y, Quad* quad){
+    const QuadPosition p = quad_position(tri, x, y);
+    const __m128 inv_w = evaluate_lanes(attributes.inv_w, p);
+    const __m128 w = _mm_div_ps(_mm_set1_ps(1.f), inv_w);
+
+    // attributes in SoA form, one register of 4 lanes per component
+    alignas(16) std::array<std::array<float, 4>, ATTRIBUTE_COUNT> soa;
+    for (std::uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+        _mm_store_ps(soa[i].data(), _mm_mul_ps(evaluate_lanes(attributes.attributes[i], p), w));
+    alignas(16) std::array<float, 4> inv_w_lanes;
+    _mm_store_ps(inv_w_lanes.data(), inv_w);
+
+    for (std::uint32_t lane = 0; lane < 4; lane++)
+        set_fragment(&quad->fragments[lane], &soa[0][lane], 4, attributes.world_norm,
+            static_cast<float>(x + static_cast<std::int32_t>(lane & 1)), static_cast<float>(y + static_cast<std::int32_t>(lane >> 1)), quad->depth[lane], inv_w_lanes[lane]);
+}
+
+// the whole quad must lie inside the depth buffer and belong to the calling tile
+template<DepthTestMode DEPTH_TEST, bool DEPTH_WRITE>
+std::uint32_t depth_test_quad_simd(ImageView<std::uint32_t>* depth_buffer, const Quad& quad, std::uint32_t mask, std::int32_t x, std::int32_t y){
+    __m128 d = _mm_load_ps(quad.depth.data());
+    d = _mm_min_ps(_mm_max_ps(d, _mm_setzero_ps()), _mm_set1_ps(MAX_DEPTH_VALUE));
+
+    // float -> uint32, the SSE conversion is signed only
+    const __m128 two_31 = _mm_set1_ps(2147483648.f);
+    const __m128 is_large = _mm_cmpge_ps(d, two_31);
+    const __m128i depth = _mm_xor_si128(
+        _mm_cvttps_epi32(_mm_sub_ps(d, _mm_and_ps(is_large, two_31))),
+        _mm_and_si128(_mm_castps_si128(is_large), _mm_set1_epi32(static_cast<int>(0x80000000u))));
+
+    std::uint32_t* row0 = &depth_buffer->at(x, y);
+    std::uint32_t* row1 = &depth_buffer->at(x, y + 1);
+    const __m128i reference = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row0)), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row1)));
+
+    const __m128i sign = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    const __m128i value_s = _mm_xor_si128(depth, sign);
+    const __m128i reference_s = _mm_xor_si128(reference, sign);
+    const __m128i all = _mm_set1_epi32(-1);
+    __m128i pass;
+    if constexpr (DEPTH_TEST == DepthTestMode::ALWAYS) pass = all;
+    else if constexpr (DEPTH_TEST == DepthTestMode::LESS) pass = _mm_cmplt_epi32(value_s, reference_s);
+    else if constexpr (DEPTH_TEST == DepthTestMode::LESSEQUAL) pass = _mm_xor_si128(_mm_cmpgt_epi32(value_s, reference_s), all);
+    else if constexpr (DEPTH_TEST == DepthTestMode::GREATER) pass = _mm_cmpgt_epi32(value_s, reference_s);
+    else if constexpr (DEPTH_TEST == DepthTestMode::GREATEREQUAL) pass = _mm_xor_si128(_mm_cmplt_epi32(value_s, reference_s), all);
+    else if constexpr (DEPTH_TEST == DepthTestMode::EQUAL) pass = _mm_cmpeq_epi32(value_s, reference_s);
+    else if constexpr (DEPTH_TEST == DepthTestMode::NOTEQUAL) pass = _mm_xor_si128(_mm_cmpeq_epi32(value_s, reference_s), all);
+    else pass = _mm_setzero_si128();
+    const __m128i lane_mask = _mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(mask)), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128());
+    pass = _mm_and_si128(pass, lane_mask);
+
+    if constexpr (DEPTH_WRITE){
+        const __m128i result = _mm_blendv_epi8(reference, depth, pass);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(row0), result);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(row1), _mm_unpackhi_epi64(result, result));
+    }
+    return static_cast<std::uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(pass)));
+}
+#endif
+
+// blocks are tested against the edge functions as a whole before walking their quads
+constexpr std::int32_t BLOCK_SIZE = 8;
+// screen tiles shaded independently by draw_new, a multiple of BLOCK_SIZE so hi-z blocks never straddle two tiles
+constexpr std::int32_t TILE_SIZE = 64;
+
+// evaluating the depth plane can undershoot the vertex depths by a few float ulps, hi-z tests
+// are made against depths pulled this much (in depth buffer units) towards the camera so they
+// never reject a visible pixel
+constexpr float HIZ_DEPTH_MARGIN = 32768.f;
+
+HiZBuffer Renderer::create_hiz_buffer(std::uint32_t width, std::uint32_t height){
+    const std::uint32_t blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE, blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const std::uint32_t tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE, tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    return HiZBuffer{
+        .blocks = Image<std::uint32_t>{
+            .image = std::vector<std::uint32_t>(blocks_x * blocks_y, 0xFFFFFFFF),
+            .width = blocks_x,
+            .height = blocks_y,
+        },
+        .tiles = Image<std::uint32_t>{
+            .image = std::vector<std::uint32_t>(tiles_x * tiles_y, 0xFFFFFFFF),
+            .width = tiles_x,
+            .height = tiles_y,
+        },
+    };
+}
+
+void Renderer::clear_depth(FrameBuffer* frame_buffer, std::uint32_t depth){
+    if (frame_buffer->depth_buffer_view.has_value()) clear(&*frame_buffer->depth_buffer_view, depth);
+    if (frame_buffer->hiz_buffer){
+        std::fill(frame_buffer->hiz_buffer->blocks.image.begin(), frame_buffer->hiz_buffer->blocks.image.end(), depth);
+        std::fill(frame_buffer->hiz_buffer->tiles.image.begin(), frame_buffer->hiz_buffer->tiles.image.end(), depth);
+    }
+}
+
+// every draw that writes depth keeps hi-z up to date, whatever its depth test. a draw with another
+// test than LESS or LESSEQUAL can move depth farther away and the maxima have to follow.
+inline HiZBuffer* get_hiz_buffer(FrameBuffer* frame_buffer){
+    if (!frame_buffer->hiz_buffer || !frame_buffer->depth_buffer_view.has_value()) return nullptr;
+    return frame_buffer->hiz_buffer;
+}
+
+// true when nothing at near_depth (depth buffer units) or farther can pass the depth test against
+// farthest_depth. only tests that reject fragments that are farther away can be decided here.
+inline bool is_hiz_occluded(DepthTestMode mode, float near, std::uint32_t farthest_depth){
+    if (mode != DepthTestMode::LESS && mode != DepthTestMode::LESSEQUAL) return false;
+    const std::uint32_t near_depth = quantize_depth(near - HIZ_DEPTH_MARGIN);
+    return mode == DepthTestMode::LESS ? near_depth >= farthest_depth : near_depth > farthest_depth;
+}
+
+void update_hiz_block(const ImageView<std::uint32_t>& depth_buffer, HiZBuffer* hiz, std::int32_t block_x, std::int32_t block_y){
+    const std::int32_t x0 = block_x * BLOCK_SIZE, y0 = block_y * BLOCK_SIZE;
+    const std::int32_t x1 = std::min<std::int32_t>(x0 + BLOCK_SIZE, depth_buffer.width);
+    const std::int32_t y1 = std::min<std::int32_t>(y0 + BLOCK_SIZE, depth_buffer.height);
+    std::uint32_t farthest = 0;
+    for (std::int32_t y = y0; y < y1; y++)
+    for (std::int32_t x = x0; x < x1; x++)
+        farthest = std::max(farthest, depth_buffer.at(x, y));
+    hiz->blocks.at(block_x, block_y) = farthest;
+}
+
+void update_hiz_tile(HiZBuffer* hiz, std::int32_t tile_x, std::int32_t tile_y){
+    constexpr std::int32_t blocks_per_tile = TILE_SIZE / BLOCK_SIZE;
+    const std::int32_t x0 = tile_x * blocks_per_tile, y0 = tile_y * blocks_per_tile;
+    const std::int32_t x1 = std::min<std::int32_t>(x0 + blocks_per_tile, hiz->blocks.width);
+    const std::int32_t y1 = std::min<std::int32_t>(y0 + blocks_per_tile, hiz->blocks.height);
+    std::uint32_t farthest = 0;
+    for (std::int32_t y = y0; y < y1; y++)
+    for (std::int32_t x = x0; x < x1; x++)
+        farthest = std::max(farthest, hiz->blocks.at(x, y));
+    hiz->tiles.at(tile_x, tile_y) = farthest;
+}
+
+// nearest depth the triangle can have inside the block at pixel (x, y). depth is linear in
+// screen space, so its minimum over the block is at one of the corners.
+float block_min_depth(const TriangleSetup& tri, std::int32_t x, std::int32_t y){
+    const float fx = static_cast<float>(x - tri.xmin), fy = static_cast<float>(y - tri.ymin);
+    float min_depth = std::numeric_limits<float>::max();
+    for (std::int32_t corner = 0; corner < 4; corner++){
+        const float cx = static_cast<float>((corner & 1) * (BLOCK_SIZE - 1)), cy = static_cast<float>((corner >> 1) * (BLOCK_SIZE - 1));
+        min_depth = std::min(min_depth, evaluate(tri.depth, fx + cx, fy + cy));
+    }
+    return std::max(min_depth, tri.min_depth);
+}
+
+// what the raster stage writes besides depth
+enum class RasterOutput{
+    NONE,
+    COLOR,
+    VISIBILITY,
+};
+
+// rasterizes the part of the triangle that falls into scissor.
+// quads stay aligned to the triangle's bounding box, so a pixel gets the same
+// value (including texcoord derivatives) no matter how the screen is split.
+// the pipeline state is a template parameter, see select_rasterizer, so the quad loop only
+// contains the work this draw needs. ALWAYS without DEPTH_WRITE leaves the depth buffer untouched.
+template<DepthTestMode DEPTH_TEST, bool DEPTH_WRITE, RasterOutput OUTPUT>
+void rasterize_triangle(FrameBuffer* frame_buffer, const DrawCall& command, const Uniform& uniform, const TriangleSetup& tri, const TriangleAttributes* attributes, const Rect& scissor){
+    constexpr bool USES_DEPTH = DEPTH_WRITE || DEPTH_TEST != DepthTestMode::ALWAYS;
+
+    const std::int32_t xmin = tri.xmin, xmax = tri.xmax, ymin = tri.ymin, ymax = tri.ymax;
+    const auto& edges = tri.edges;
+
+    const std::int32_t ystart = ymin + std::max(0, (scissor.y0 - ymin) / 2 * 2);
+    const std::int32_t xstart = xmin + std::max(0, (scissor.x0 - xmin) / 2 * 2);
+    const std::int32_t yend = std::min(ymax + 1, scissor.y1);
+    const std::int32_t xend = std::min(xmax + 1, scissor.x1);
+
+    HiZBuffer* hiz = get_hiz_buffer(frame_buffer);
+    const DepthTestMode depth_mode = command.depth_settings.test_mode;
+    ImageView<std::uint32_t>* depth_buffer = USES_DEPTH ? &*frame_buffer->depth_buffer_view : nullptr;
+
+    Quad quad;
+    for (std::int32_t by = ystart; by < yend; by += BLOCK_SIZE)
+    for (std::int32_t bx = xstart; bx < xend; bx += BLOCK_SIZE){
+        std::array<std::int64_t, 3> block_edges;
+        for (int k = 0; k < 3; k++)
+            block_edges[k] = edges[k].origin + (bx - xmin) * edges[k].step_x + (by - ymin) * edges[k].step_y;
+
+        // the edge functions are linear, so their extremes over the block are at its corners
+        bool is_outside = false;
+        bool is_fully_covered = true;
+        for (int k = 0; k < 3; k++){
+            const std::int64_t span_x = (BLOCK_SIZE - 1) * edges[k].step_x;
+            const std::int64_t span_y = (BLOCK_SIZE - 1) * edges[k].step_y;
+            const std::int64_t e = block_edges[k] + edges[k].bias;
+            const std::int64_t e_max = e + std::max<std::int64_t>(0, span_x) + std::max<std::int64_t>(0, span_y);
+            const std::int64_t e_min = e + std::min<std::int64_t>(0, span_x) + std::min<std::int64_t>(0, span_y);
+            is_outside = is_outside || e_max <= 0;
+            is_fully_covered = is_fully_covered && e_min > 0;
+        }
+        if (is_outside) continue;
+
+        const std::int32_t block_yend = std::min(by + BLOCK_SIZE, yend);
+        const std::int32_t block_xend = std::min(bx + BLOCK_SIZE, xend);
+
+        // the block is not aligned to the hi-z grid, it overlaps up to 2x2 hi-z blocks inside the scissor
+        const std::int32_t hiz_x0 = std::max(bx, scissor.x0) / BLOCK_SIZE, hiz_x1 = (block_xend - 1) / BLOCK_SIZE;
+        const std::int32_t hiz_y0 = std::max(by, scissor.y0) / BLOCK_SIZE, hiz_y1 = (block_yend - 1) / BLOCK_SIZE;
+        if (hiz){
+            std::uint32_t farthest = 0;
+            for (std::int32_t hy = hiz_y0; hy <= hiz_y1; hy++)
+            for (std::int32_t hx = hiz_x0; hx <= hiz_x1; hx++)
+                farthest = std::max(farthest, hiz->blocks.at(hx, hy));
+            if (is_hiz_occluded(depth_mode, block_min_depth(tri, bx, by), farthest)) continue;
         }
+        bool wrote_depth = false;
+
+        for (std::int32_t y = by; y < block_yend; y += 2){
+            std::array<std::int64_t, 3> quad_edges = block_edges;
+            for (int k = 0; k < 3; k++) block_edges[k] += 2 * edges[k].step_y;
+
+            for (std::int32_t x = bx; x < block_xend; x += 2){
+                const std::array<std::int64_t, 3> current_edges = quad_edges;
+                for (int k = 0; k < 3; k++) quad_edges[k] += 2 * edges[k].step_x;
+
+                // fully covered blocks skip the per-pixel coverage test
+                std::uint32_t coverage = quad_bounds_mask(tri, x, y);
+                if (!is_fully_covered){
+#if defined(__AVX2__)
+                    coverage &= quad_coverage_simd(tri, current_edges);
+#else
+                    coverage &= quad_coverage_scalar(tri, current_edges);
+#endif
+                }
+                if (coverage == 0) continue;
+                quad.coverage = coverage;
+
+#if defined(__AVX2__)
+                interpolate_depth_simd(tri, x, y, &quad);
+#else
+                interpolate_depth_scalar(tri, x, y, &quad);
+#endif
+
+                const bool inside_scissor = x >= scissor.x0 && x + 1 < scissor.x1 && y >= scissor.y0 && y + 1 < scissor.y1;
+                std::uint32_t mask = quad.coverage;
+                if (!inside_scissor){
+                    for (std::uint32_t lane = 0; lane < 4; lane++){
+                        const std::int32_t px = x + static_cast<std::int32_t>(lane & 1), py = y + static_cast<std::int32_t>(lane >> 1);
+                        if (px < scissor.x0 || px >= scissor.x1 || py < scissor.y0 || py >= scissor.y1) mask &= ~(1u << lane);
+                    }
+                }
 
-        for (int dy = 0; dy < 2; dy++)
-        for (int dx = 0; dx < 2; dx++){
-            if (x + dx > xmax || y + dy > ymax) continue;
-            if (det01p[dy][dx] < 0.f || det12p[dy][dx] < 0.f || det20p[dy][dx] < 0.f) continue;
+                if constexpr (USES_DEPTH){
+#if defined(__AVX2__)
+                    if (inside_scissor)
+                        mask = depth_test_quad_simd<DEPTH_TEST, DEPTH_WRITE>(depth_buffer, quad, mask, x, y);
+                    else
+#endif
+                        mask = depth_test_quad_scalar<DEPTH_TEST, DEPTH_WRITE>(depth_buffer, quad, mask, x, y);
+                    if constexpr (DEPTH_WRITE) wrote_depth = wrote_depth || mask != 0;
+                }
 
-            if (frame_buffer->depth_buffer_view.has_value()) {
-                std::uint32_t depth = static_cast<uint32_t>((0.5f + 0.5f * vertices[dy][dx].ndc_pos.z) * UINT32_MAX);
+                if constexpr (OUTPUT == RasterOutput::VISIBILITY){
+                    for (std::uint32_t lane = 0; lane < 4; lane++)
+                        if ((mask >> lane) & 1)
+                            frame_buffer->visibility_buffer_view->at(x + (lane & 1), y + (lane >> 1)) = VisibilityId{command.draw_id, tri.triangle_id};
+                }
 
-                if (!depth_test_passed(command.depth_settings.test_mode, depth, frame_buffer->depth_buffer_view->at(x + dx, y + dy)))
-                    continue;
+                if constexpr (OUTPUT != RasterOutput::COLOR) continue;
+                if (mask == 0) continue;
+
+#if defined(__AVX2__)
+                interpolate_quad_simd(tri, *attributes, x, y, &quad);
+#else
+                interpolate_quad_scalar(tri, *attributes, x, y, &quad);
+#endif
+
+                for (std::uint32_t lane = 0; lane < 4; lane++){
+                    if (!((mask >> lane) & 1)) continue;
+                    const std::uint32_t dx = lane & 1, dy = lane >> 1;
+                    const auto& fragments = quad.fragments;
+
+                    auto sample_texcoord0 = [&fragments, dx, dy](Texture<R8G8B8A8_U>* tex) {
+                        return sample_texture(tex,
+                            fragments[dy * 2 + dx].texcoord,
+                            fragments[dy * 2 + 1].texcoord - fragments[dy * 2 + 0].texcoord,
+                            fragments[2 + dx].texcoord - fragments[dx].texcoord);
+                    };
+
+                    glm::vec4 color = fragment_shader(fragments[lane], uniform, sample_texcoord0).color;
+
+                    frame_buffer->color_buffer_view->at(x + dx, y + dy) = to_r8g8b8a8_u(color);
+                }
+            }
+        }
+
+        if (hiz && wrote_depth){
+            for (std::int32_t hy = hiz_y0; hy <= hiz_y1; hy++)
+            for (std::int32_t hx = hiz_x0; hx <= hiz_x1; hx++)
+                update_hiz_block(*frame_buffer->depth_buffer_view, hiz, hx, hy);
+        }
+    }
+}
+
+// frame buffers without color or visibility attachments take the depth only path: triangles
+// set up nothing but their depth plane and the rasterizer never interpolates attributes
+inline RasterOutput get_raster_output(const FrameBuffer* frame_buffer){
+    if (frame_buffer->visibility_buffer_view.has_value()) return RasterOutput::VISIBILITY;
+    return frame_buffer->color_buffer_view.has_value() ? RasterOutput::COLOR : RasterOutput::NONE;
+}
+
+using RasterizeFunction = void(*)(FrameBuffer* frame_buffer, const DrawCall& command, const Uniform& uniform, const TriangleSetup& tri, const TriangleAttributes* attributes, const Rect& scissor);
+
+template<DepthTestMode DEPTH_TEST, bool DEPTH_WRITE>
+RasterizeFunction select_rasterizer(RasterOutput output){
+    switch (output){
+    case RasterOutput::COLOR: return &rasterize_triangle<DEPTH_TEST, DEPTH_WRITE, RasterOutput::COLOR>;
+    case RasterOutput::VISIBILITY: return &rasterize_triangle<DEPTH_TEST, DEPTH_WRITE, RasterOutput::VISIBILITY>;
+    default: return &rasterize_triangle<DEPTH_TEST, DEPTH_WRITE, RasterOutput::NONE>;
+    }
+}
+
+template<DepthTestMode DEPTH_TEST>
+RasterizeFunction select_rasterizer(bool depth_write, RasterOutput output){
+    return depth_write ? select_rasterizer<DEPTH_TEST, true>(output) : select_rasterizer<DEPTH_TEST, false>(output);
+}
+
+// picks the rasterize_triangle specialization for the attachments of frame_buffer and the
+// state of command, once per draw. returns nullptr when the draw cannot produce any fragment.
+RasterizeFunction select_rasterizer(const FrameBuffer* frame_buffer, const DrawCall& command){
+    const RasterOutput output = get_raster_output(frame_buffer);
+
+    // without a depth buffer every fragment passes and nothing is written
+    if (!frame_buffer->depth_buffer_view.has_value())
+        return select_rasterizer<DepthTestMode::ALWAYS, false>(output);
+
+    const bool write = command.depth_settings.write;
+    switch (command.depth_settings.test_mode){
+    case DepthTestMode::ALWAYS: return select_rasterizer<DepthTestMode::ALWAYS>(write, output);
+    case DepthTestMode::LESS: return select_rasterizer<DepthTestMode::LESS>(write, output);
+    case DepthTestMode::LESSEQUAL: return select_rasterizer<DepthTestMode::LESSEQUAL>(write, output);
+    case DepthTestMode::GREATER: return select_rasterizer<DepthTestMode::GREATER>(write, output);
+    case DepthTestMode::GREATEREQUAL: return select_rasterizer<DepthTestMode::GREATEREQUAL>(write, output);
+    case DepthTestMode::EQUAL: return select_rasterizer<DepthTestMode::EQUAL>(write, output);
+    case DepthTestMode::NOTEQUAL: return select_rasterizer<DepthTestMode::NOTEQUAL>(write, output);
+    default: return nullptr;
+    }
+}
+
+// geometry stage works on packets of triangles in structure of arrays form, [vertex][lane]
+constexpr std::uint32_t PACKET_SIZE = 8;
+
+struct TrianglePacket{
+    alignas(32) float x[3][PACKET_SIZE];
+    alignas(32) float y[3][PACKET_SIZE];
+    alignas(32) float z[3][PACKET_SIZE];
+    alignas(32) float w[3][PACKET_SIZE];
+};
+
+// returns the lanes that can be thrown away before clipping: all vertices outside the same clip
+// plane, facing the culled side, or zero area. the winding is the sign of the determinant of the
+// clip space (x, y, w) columns, which is only meaningful when every vertex is in front of the camera.
+std::uint32_t cull_packet_scalar(const TrianglePacket& packet, CullMode cull_mode){
+    std::uint32_t rejected = 0;
+    for (std::uint32_t lane = 0; lane < PACKET_SIZE; lane++){
+        std::uint32_t outside_all = 0b111111;
+        bool is_in_front = true;
+        for (int v = 0; v < 3; v++){
+            const float x = packet.x[v][lane], y = packet.y[v][lane], z = packet.z[v][lane], w = packet.w[v][lane];
+            outside_all &= (x < -w ? 1u : 0u) | (x > w ? 2u : 0u) | (y < -w ? 4u : 0u) | (y > w ? 8u : 0u) | (z < -w ? 16u : 0u) | (z > w ? 32u : 0u);
+            is_in_front = is_in_front && w > 0.f;
+        }
 
-                if (command.depth_settings.write)
-                    frame_buffer->depth_buffer_view->at(x + dx, y + dy) = depth;
+        const float x0 = packet.x[0][lane], x1 = packet.x[1][lane], x2 = packet.x[2][lane];
+        const float y0 = packet.y[0][lane], y1 = packet.y[1][lane], y2 = packet.y[2][lane];
+        const float w0 = packet.w[0][lane], w1 = packet.w[1][lane], w2 = packet.w[2][lane];
+        const float det = x0 * (y1 * w2 - y2 * w1) - x1 * (y0 * w2 - y2 * w0) + x2 * (y0 * w1 - y1 * w0);
+
+        bool is_culled = outside_all != 0;
+        if (is_in_front){
+            switch (cull_mode){
+            case CullMode::CLOCK_WISE: is_culled = is_culled || det <= 0.f; break;
+            case CullMode::COUNTER_CLOCK_WISE: is_culled = is_culled || det >= 0.f; break;
+            default: is_culled = is_culled || det == 0.f; break;
             }
+        }
+        if (is_culled) rejected |= 1u << lane;
+    }
+    return rejected;
+}
+
+#if defined(__AVX2__)
+inline std::uint32_t cull_packet_simd(const TrianglePacket& packet, CullMode cull_mode){
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 outside_all[6];
+    __m256 is_in_front = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int i = 0; i < 6; i++) outside_all[i] = is_in_front;
+
+    __m256 x[3], y[3], w[3];
+    for (int v = 0; v < 3; v++){
+        x[v] = _mm256_load_ps(packet.x[v]);
+        y[v] = _mm256_load_ps(packet.y[v]);
+        w[v] = _mm256_load_ps(packet.w[v]);
+        const __m256 z = _mm256_load_ps(packet.z[v]);
+        const __m256 neg_w = _mm256_sub_ps(zero, w[v]);
+        outside_all[0] = _mm256_and_ps(outside_all[0], _mm256_cmp_ps(x[v], neg_w, _CMP_LT_OQ));
+        outside_all[1] = _mm256_and_ps(outside_all[1], _mm256_cmp_ps(x[v], w[v], _CMP_GT_OQ));
+        outside_all[2] = _mm256_and_ps(outside_all[2], _mm256_cmp_ps(y[v], neg_w, _CMP_LT_OQ));
+        outside_all[3] = _mm256_and_ps(outside_all[3], _mm256_cmp_ps(y[v], w[v], _CMP_GT_OQ));
+        outside_all[4] = _mm256_and_ps(outside_all[4], _mm256_cmp_ps(z, neg_w, _CMP_LT_OQ));
+        outside_all[5] = _mm256_and_ps(outside_all[5], _mm256_cmp_ps(z, w[v], _CMP_GT_OQ));
+        is_in_front = _mm256_and_ps(is_in_front, _mm256_cmp_ps(w[v], zero, _CMP_GT_OQ));
+    }
+
+    // same operation order as the scalar version so both paths agree on the sign
+    const __m256 det = _mm256_add_ps(
+        _mm256_sub_ps(
+            _mm256_mul_ps(x[0], _mm256_sub_ps(_mm256_mul_ps(y[1], w[2]), _mm256_mul_ps(y[2], w[1]))),
+            _mm256_mul_ps(x[1], _mm256_sub_ps(_mm256_mul_ps(y[0], w[2]), _mm256_mul_ps(y[2], w[0])))),
+        _mm256_mul_ps(x[2], _mm256_sub_ps(_mm256_mul_ps(y[0], w[1]), _mm256_mul_ps(y[1], w[0]))));
+
+    __m256 is_culled = _mm256_or_ps(
+        _mm256_or_ps(_mm256_or_ps(outside_all[0], outside_all[1]), _mm256_or_ps(outside_all[2], outside_all[3])),
+        _mm256_or_ps(outside_all[4], outside_all[5]));
+    __m256 is_facing_away;
+    switch (cull_mode){
+    case CullMode::CLOCK_WISE: is_facing_away = _mm256_cmp_ps(det, zero, _CMP_LE_OQ); break;
+    case CullMode::COUNTER_CLOCK_WISE: is_facing_away = _mm256_cmp_ps(det, zero, _CMP_GE_OQ); break;
+    default: is_facing_away = _mm256_cmp_ps(det, zero, _CMP_EQ_OQ); break;
+    }
+    is_culled = _mm256_or_ps(is_culled, _mm256_and_ps(is_in_front, is_facing_away));
+    return static_cast<std::uint32_t>(_mm256_movemask_ps(is_culled));
+}
+#endif
+
+// sort-middle binning: the geometry stage splits the index buffer into batches that are
+// transformed, clipped and set up in parallel, and each batch sorts its triangles into
+// screen tiles. the raster stage then shades tiles in parallel, walking the batches in
+// submission order, so every pixel still sees triangles in the order of the index buffer.
+constexpr std::uint32_t TRIANGLES_PER_BATCH = 1024;
+
+// direct mapped post-transform cache, one per geometry batch. indexed meshes reference
+// vertices close to each other, so most shared vertices are found without running vertex_shader again
+constexpr std::uint32_t VERTEX_CACHE_SIZE = 1024;
+
+struct VertexCache{
+    std::array<std::uint32_t, VERTEX_CACHE_SIZE> indices;
+    std::array<VertOut, VERTEX_CACHE_SIZE> vertices;
+};
+
+struct GeometryBatch{
+    std::vector<TriangleSetup> triangles;
+    std::vector<TriangleAttributes> attributes; // parallel to triangles, empty for depth only draws
+    std::vector<std::vector<std::uint32_t>> tile_bins;
+    std::uint32_t vertex_cache_lookups = 0;
+    std::uint32_t vertex_cache_hits = 0;
+};
+
+// everything the geometry and raster stages need to know about one output of a draw
+struct RenderTarget{
+    FrameBuffer* frame_buffer;
+    ViewPort viewport;
+    Uniform fragment_uniform;
+    RasterizeFunction rasterize;
+    bool needs_attributes;
+    ClipPlanes clip_planes;
+    std::int32_t width, height;
+    std::int32_t tiles_x, tiles_y;
+    std::uint32_t tile_count;
+    HiZBuffer* hiz; // tile level hi-z is only updated between draws, so it is stable during the geometry stage
+};
+
+// rasterize is nullptr when the draw cannot produce any fragment in frame_buffer
+RenderTarget create_render_target(FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport, const glm::mat4& vp_transform){
+    const std::int32_t width = static_cast<std::int32_t>(get_width(frame_buffer));
+    const std::int32_t height = static_cast<std::int32_t>(get_height(frame_buffer));
+    const std::int32_t tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const std::int32_t tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    return RenderTarget{
+        .frame_buffer = frame_buffer,
+        .viewport = viewport,
+        .fragment_uniform = Uniform{
+            .model_mat = command.world_transform,
+            .proj_view_mat = vp_transform,
+            .light_mat = command.light_mat,
+            .light_dir = command.light_direction,
+            .material = command.material,
+            .shadows = command.shadows,
+            .irradiance_volume = command.irradiance_volume,
+        },
+        .rasterize = select_rasterizer(frame_buffer, command),
+        .needs_attributes = get_raster_output(frame_buffer) == RasterOutput::COLOR,
+        .clip_planes = guard_band_clip_planes(
+            std::max(1.f, 2.f * GUARD_BAND_COORD / static_cast<float>(viewport.width)),
+            std::max(1.f, 2.f * GUARD_BAND_COORD / static_cast<float>(viewport.height))),
+        .width = width,
+        .height = height,
+        .tiles_x = tiles_x,
+        .tiles_y = tiles_y,
+        .tile_count = static_cast<std::uint32_t>(tiles_x * tiles_y),
+        .hiz = get_hiz_buffer(frame_buffer),
+    };
+}
 
-            if (frame_buffer->color_buffer_view.has_value()) {
-                auto sample_texcoord0 = [&vertices, dx, dy](Texture<R8G8B8A8_U>* tex) {
-                    if (!tex) return glm::vec4(0.f);
-                    glm::vec2 texture_scale(tex->mipmaps[0].width, tex->mipmaps[0].height);
-                    glm::vec2 tc = texture_scale * vertices[dy][dx].texcoord;
-                    glm::vec2 tc_dx = texture_scale * (vertices[dy][1].texcoord - vertices[dy][0].texcoord);
-                    glm::vec2 tc_dy = texture_scale * (vertices[1][dx].texcoord - vertices[0][dx].texcoord);
-                    float texel_area = 1.f / std::abs(det(tc_dx, tc_dy));
-                    auto mipmap = select_mipmap(tex, texel_area);
-                    auto mip_level = mipmap - tex->mipmaps.data();
-                    tc.x = static_cast<float>(fmod(tc.x, mipmap->width)); 
-                    if (tc.x < 0.f) tc.x += mipmap->width;
-                    tc.y = static_cast<float>(fmod(tc.y, mipmap->height));
-                    if (tc.y < 0.f) tc.y += mipmap->height;    
-                    return sample_texture_at(mipmap, tc);
-                };
-
-                glm::vec4 color = fragment_shader(vertices[dy][dx], uniform, sample_texcoord0).color;
-
-                // glm::vec4 albedo = sample_texcoord0(command.material->diffuse_tex);
-                frame_buffer->color_buffer_view->at(x+dx, y+dy) = to_r8g8b8a8_u(color);
+// culls the lanes of a packet whose vertices are in the clip space of target, then clips, sets up
+// and bins the survivors into batch. lanes not set in lane_mask are ignored.
+void bin_packet(const RenderTarget& target, const DrawCall& command, const VertOut (&packet_vertices)[PACKET_SIZE][3], const TrianglePacket& packet,
+                std::uint32_t lane_mask, std::uint32_t packet_first, GeometryBatch* batch){
+    // frustum, backface and zero area rejection for the whole packet
+#if defined(__AVX2__)
+    const std::uint32_t rejected = cull_packet_simd(packet, command.cull_mode);
+#else
+    const std::uint32_t rejected = cull_packet_scalar(packet, command.cull_mode);
+#endif
+    std::uint32_t survivors = ~rejected & lane_mask;
+
+    // compact the survivors so clipping and setup only see triangles that may be visible
+    std::uint32_t survivor_lanes[PACKET_SIZE];
+    std::uint32_t survivor_count = 0;
+    for (; survivors != 0; survivors &= survivors - 1)
+        survivor_lanes[survivor_count++] = static_cast<std::uint32_t>(std::countr_zero(survivors));
+
+    const DepthTestMode depth_mode = command.depth_settings.test_mode;
+    for (std::uint32_t survivor = 0; survivor < survivor_count; survivor++){
+        const std::uint32_t lane = survivor_lanes[survivor];
+        const VertOut* triangle = packet_vertices[lane];
+
+        // triangles inside the guard band and the depth range go straight to setup,
+        // the rest are clipped to a polygon and drawn as a fan
+        std::array<VertOut, MAX_CLIPPED_VERTICES> polygon;
+        std::uint32_t polygon_count = 3;
+        const std::uint32_t plane_mask =
+            clip_outcode(triangle[0].ndc_pos, target.clip_planes) |
+            clip_outcode(triangle[1].ndc_pos, target.clip_planes) |
+            clip_outcode(triangle[2].ndc_pos, target.clip_planes);
+        if (plane_mask == 0) std::copy(triangle, triangle + 3, polygon.data());
+        else polygon_count = clip_polygon(triangle, target.clip_planes, plane_mask, polygon);
+
+        for (std::uint32_t i = 2; i < polygon_count; i++){
+            TriangleAttributes attributes;
+            auto setup = setup_triangle(target.frame_buffer, command, target.viewport, polygon[0], polygon[i - 1], polygon[i], target.needs_attributes ? &attributes : nullptr);
+            if (!setup.has_value()) continue;
+            setup->triangle_id = packet_first + lane;
+
+            const std::uint32_t setup_idx = static_cast<std::uint32_t>(batch->triangles.size());
+            batch->triangles.push_back(*setup);
+            if (target.needs_attributes) batch->attributes.push_back(attributes);
+
+            const std::int32_t tx0 = setup->xmin / TILE_SIZE, tx1 = std::min(setup->xmax / TILE_SIZE, target.tiles_x - 1);
+            const std::int32_t ty0 = setup->ymin / TILE_SIZE, ty1 = std::min(setup->ymax / TILE_SIZE, target.tiles_y - 1);
+            for (std::int32_t ty = ty0; ty <= ty1; ty++)
+            for (std::int32_t tx = tx0; tx <= tx1; tx++){
+                if (target.hiz && is_hiz_occluded(depth_mode, setup->min_depth, target.hiz->tiles.at(tx, ty))) continue;
+                batch->tile_bins[ty * target.tiles_x + tx].push_back(setup_idx);
             }
+        }
+    }
+}
 
-            // frame_buffer->color_buffer_view->at(x+dx, y+dy) = to_r8g8b8a8_u(glm::vec4(vertices.world_pos.xyz, 1.f));
+// shades one tile of target with the triangles binned to it by every batch, in batch order
+void rasterize_tile(const RenderTarget& target, const DrawCall& command, const GeometryBatch* batches, std::uint32_t batch_count, std::uint32_t tile_idx){
+    const std::int32_t tx = static_cast<std::int32_t>(tile_idx) % target.tiles_x;
+    const std::int32_t ty = static_cast<std::int32_t>(tile_idx) / target.tiles_x;
+    const Rect tile{
+        .x0 = tx * TILE_SIZE,
+        .y0 = ty * TILE_SIZE,
+        .x1 = std::min(target.width, (tx + 1) * TILE_SIZE),
+        .y1 = std::min(target.height, (ty + 1) * TILE_SIZE),
+    };
+
+    bool is_empty = true;
+    for (std::uint32_t batch_idx = 0; batch_idx < batch_count; batch_idx++){
+        const GeometryBatch& batch = batches[batch_idx];
+        for (std::uint32_t setup_idx : batch.tile_bins[tile_idx]){
+            target.rasterize(target.frame_buffer, command, target.fragment_uniform, batch.triangles[setup_idx], target.needs_attributes ? &batch.attributes[setup_idx] : nullptr, tile);
+            is_empty = false;
         }
     }
-    
+
+    if (target.hiz && !is_empty && command.depth_settings.write) update_hiz_tile(target.hiz, tx, ty);
+}
+
+// looks up a vertex in the cache of the batch, running vertex_shader on a miss
+inline VertOut fetch_vertex(const DrawCall& command, const Uniform& uniform, std::uint32_t index, VertexCache* vertex_cache, GeometryBatch* batch){
+    const std::uint32_t slot = index % VERTEX_CACHE_SIZE;
+    batch->vertex_cache_lookups++;
+    if (vertex_cache->indices[slot] == index){
+        batch->vertex_cache_hits++;
+        return vertex_cache->vertices[slot];
+    }
+    const PackedVertex& packed = command.vertex_buffer->at(index);
+    const VertIn vertex_input = VertIn{
+        .model_pos = unpack_position(packed, command.quantization),
+        .texcoord = unpack_texcoord(packed, command.quantization),
+    };
+    const VertOut vertex = vertex_shader(vertex_input, uniform);
+    vertex_cache->indices[slot] = index;
+    vertex_cache->vertices[slot] = vertex;
+    return vertex;
+}
+
+inline void set_packet_vertex(TrianglePacket* packet, std::uint32_t lane, std::uint32_t i, const glm::vec4& ndc_pos){
+    packet->x[i][lane] = ndc_pos.x;
+    packet->y[i][lane] = ndc_pos.y;
+    packet->z[i][lane] = ndc_pos.z;
+    packet->w[i][lane] = ndc_pos.w;
+}
+
+void add_draw_stats(const DrawCall& command, const GeometryBatch* batches, std::uint32_t batch_count){
+    if (!command.stats) return;
+    for (std::uint32_t batch_idx = 0; batch_idx < batch_count; batch_idx++){
+        command.stats->vertex_cache_lookups += batches[batch_idx].vertex_cache_lookups;
+        command.stats->vertex_cache_hits += batches[batch_idx].vertex_cache_hits;
+    }
 }
 
 void Renderer::draw_new(FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport){
     const Uniform uniform_buffer {
         .model_mat = command.world_transform,
         .proj_view_mat = command.vp_transform,
+        .light_mat = command.light_mat,
         .material = command.material,
     };
-    const auto frustum = extruct_frustum_planes(command.vp_transform);
 
-    for (std::uint32_t index_index = 0; index_index + 2 < command.index_buffer->size(); index_index += 3){
-        VertOut vertices[12];
-        for (std::uint32_t i = 0; i < 3; i++){
-            const std::uint32_t index = command.index_buffer->at(index_index + i);
-            const VertIn vertex_input = VertIn{
-                .model_pos = glm::vec4(command.vertex_buffer->at(index).world_position),
-                .texcoord = command.vertex_buffer->at(index).texcoord0,
-            };
+    const RenderTarget target = create_render_target(frame_buffer, command, viewport, command.vp_transform);
+    if (!target.rasterize) return;
+
+    const std::uint32_t triangle_count = static_cast<std::uint32_t>(command.index_buffer->size() / 3);
+    const std::uint32_t batch_count = (triangle_count + TRIANGLES_PER_BATCH - 1) / TRIANGLES_PER_BATCH;
+    std::vector<GeometryBatch> batches(batch_count);
+
+    parallel_for(batch_count, [&](std::uint32_t batch_idx){
+        GeometryBatch& batch = batches[batch_idx];
+        batch.tile_bins.resize(target.tile_count);
+
+        thread_local std::unique_ptr<VertexCache> vertex_cache = std::make_unique<VertexCache>();
+        vertex_cache->indices.fill(UINT32_MAX);
+
+        const std::uint32_t first = batch_idx * TRIANGLES_PER_BATCH;
+        const std::uint32_t last = std::min(triangle_count, first + TRIANGLES_PER_BATCH);
+        for (std::uint32_t packet_first = first; packet_first < last; packet_first += PACKET_SIZE){
+            const std::uint32_t packet_count = std::min(PACKET_SIZE, last - packet_first);
+
+            // transform, lanes past packet_count are left degenerate and masked out by bin_packet
+            VertOut packet_vertices[PACKET_SIZE][3];
+            TrianglePacket packet = {};
+            for (std::uint32_t lane = 0; lane < packet_count; lane++)
+            for (std::uint32_t i = 0; i < 3; i++){
+                const std::uint32_t index = command.index_buffer->at((packet_first + lane) * 3 + i);
+                packet_vertices[lane][i] = fetch_vertex(command, uniform_buffer, index, vertex_cache.get(), &batch);
+                set_packet_vertex(&packet, lane, i, packet_vertices[lane][i].ndc_pos);
+            }
+            bin_packet(target, command, packet_vertices, packet, (1u << packet_count) - 1, packet_first, &batch);
+        }
+    });
+
+    parallel_for(target.tile_count, [&](std::uint32_t tile_idx){
+        rasterize_tile(target, command, batches.data(), batch_count, tile_idx);
+    });
 
-            vertices[i] = vertex_shader(vertex_input, uniform_buffer);
+    add_draw_stats(command, batches.data(), batch_count);
+}
+
+void Renderer::draw_multiview(const std::vector<View>& views, const DrawCall& command){
+    // a triangle's view mask has one bit per view
+    constexpr std::uint32_t MAX_VIEWS = 32;
+    if (views.size() > MAX_VIEWS){
+        for (std::size_t first = 0; first < views.size(); first += MAX_VIEWS){
+            const auto begin = views.begin() + static_cast<std::ptrdiff_t>(first);
+            draw_multiview(std::vector<View>(begin, begin + static_cast<std::ptrdiff_t>(std::min<std::size_t>(MAX_VIEWS, views.size() - first))), command);
         }
+        return;
+    }
+
+    // vertices are shaded once in world space, every view only multiplies by its own matrix
+    const Uniform uniform_buffer {
+        .model_mat = command.world_transform,
+        .proj_view_mat = glm::mat4(1.f),
+        .light_mat = command.light_mat,
+        .material = command.material,
+    };
 
-        if (cull_triangle_by_world_aabb(
-            vertices[0].world_pos, 
-            vertices[1].world_pos, 
-            vertices[2].world_pos, 
-            frustum)) continue;
+    std::vector<RenderTarget> targets;
+    std::vector<Frustum> frustums;
+    std::vector<glm::mat4> vp_transforms;
+    for (const View& view : views){
+        RenderTarget target = create_render_target(view.frame_buffer, command, view.viewport, view.vp_transform);
+        if (!target.rasterize) continue;
+        targets.push_back(target);
+        frustums.push_back(extruct_frustum_planes(view.vp_transform));
+        vp_transforms.push_back(view.vp_transform);
+    }
+    const std::uint32_t view_count = static_cast<std::uint32_t>(targets.size());
+    if (view_count == 0) return;
+
+    // batches of view v are batches[v * batch_count, (v + 1) * batch_count)
+    const std::uint32_t triangle_count = static_cast<std::uint32_t>(command.index_buffer->size() / 3);
+    const std::uint32_t batch_count = (triangle_count + TRIANGLES_PER_BATCH - 1) / TRIANGLES_PER_BATCH;
+    std::vector<GeometryBatch> batches(batch_count * view_count);
+
+    parallel_for(batch_count, [&](std::uint32_t batch_idx){
+        for (std::uint32_t view = 0; view < view_count; view++)
+            batches[view * batch_count + batch_idx].tile_bins.resize(targets[view].tile_count);
+        // the cache counters of a batch are kept by its first view
+        GeometryBatch& stats_batch = batches[batch_idx];
+
+        thread_local std::unique_ptr<VertexCache> vertex_cache = std::make_unique<VertexCache>();
+        vertex_cache->indices.fill(UINT32_MAX);
+
+        const std::uint32_t first = batch_idx * TRIANGLES_PER_BATCH;
+        const std::uint32_t last = std::min(triangle_count, first + TRIANGLES_PER_BATCH);
+        for (std::uint32_t packet_first = first; packet_first < last; packet_first += PACKET_SIZE){
+            const std::uint32_t packet_count = std::min(PACKET_SIZE, last - packet_first);
+
+            // shade once, then find the views whose frustum overlaps the world space bounds of each triangle
+            VertOut world_vertices[PACKET_SIZE][3];
+            std::uint32_t view_masks[PACKET_SIZE] = {};
+            std::uint32_t packet_views = 0;
+            for (std::uint32_t lane = 0; lane < packet_count; lane++){
+                for (std::uint32_t i = 0; i < 3; i++){
+                    const std::uint32_t index = command.index_buffer->at((packet_first + lane) * 3 + i);
+                    world_vertices[lane][i] = fetch_vertex(command, uniform_buffer, index, vertex_cache.get(), &stats_batch);
+                }
+                const glm::vec3 v0 = world_vertices[lane][0].world_pos, v1 = world_vertices[lane][1].world_pos, v2 = world_vertices[lane][2].world_pos;
+                for (std::uint32_t view = 0; view < view_count; view++)
+                    if (!cull_triangle_by_world_aabb(v0, v1, v2, frustums[view])) view_masks[lane] |= 1u << view;
+                packet_views |= view_masks[lane];
+            }
 
-        auto end = clip_triangle(vertices, vertices + 3);
-        for (auto triangle_begin = vertices; triangle_begin < end; triangle_begin += 3){
-            draw_triangle(frame_buffer, command, viewport, triangle_begin[0], triangle_begin[1], triangle_begin[2]);
+            // each view only projects and bins the lanes it can see
+            for (; packet_views != 0; packet_views &= packet_views - 1){
+                const std::uint32_t view = static_cast<std::uint32_t>(std::countr_zero(packet_views));
+                VertOut packet_vertices[PACKET_SIZE][3];
+                TrianglePacket packet = {};
+                std::uint32_t lane_mask = 0;
+                for (std::uint32_t lane = 0; lane < packet_count; lane++){
+                    if (!(view_masks[lane] & (1u << view))) continue;
+                    lane_mask |= 1u << lane;
+                    for (std::uint32_t i = 0; i < 3; i++){
+                        packet_vertices[lane][i] = world_vertices[lane][i];
+                        packet_vertices[lane][i].ndc_pos = vp_transforms[view] * world_vertices[lane][i].world_pos;
+                        set_packet_vertex(&packet, lane, i, packet_vertices[lane][i].ndc_pos);
+                    }
+                }
+                bin_packet(targets[view], command, packet_vertices, packet, lane_mask, packet_first, &batches[view * batch_count + batch_idx]);
+            }
         }
+    });
+
+    // the tiles of all views form one list so small views do not leave workers idle
+    std::vector<std::uint32_t> first_tile(view_count + 1, 0);
+    for (std::uint32_t view = 0; view < view_count; view++)
+        first_tile[view + 1] = first_tile[view] + targets[view].tile_count;
+
+    parallel_for(first_tile[view_count], [&](std::uint32_t task){
+        const std::uint32_t view = static_cast<std::uint32_t>(std::upper_bound(first_tile.begin() + 1, first_tile.end(), task) - first_tile.begin()) - 1;
+        rasterize_tile(targets[view], command, &batches[view * batch_count], batch_count, task - first_tile[view]);
+    });
+
+    add_draw_stats(command, batches.data(), batch_count);
+}
+
+// triangle of a visibility buffer pixel, transformed again by the vertex shader.
+// its clip space x, y, w form a matrix whose inverse maps a point (ndc x, ndc y, 1) to the
+// barycentrics divided by w, which needs no clipping and works for vertices behind the camera.
+struct VisibleTriangle{
+    VisibilityId id = EMPTY_VISIBILITY_ID;
+    std::array<VertOut, 3> vertices;
+    glm::mat3 inv_clip;
+    glm::vec3 world_norm;
+    bool is_valid = false;
+};
+
+VisibleTriangle load_visible_triangle(const DrawCall& command, VisibilityId id){
+    const Uniform uniform {
+        .model_mat = command.world_transform,
+        .proj_view_mat = command.vp_transform,
+        .light_mat = command.light_mat,
+        .material = command.material,
+    };
+
+    VisibleTriangle tri{ .id = id };
+    for (std::uint32_t i = 0; i < 3; i++){
+        const PackedVertex& vertex = command.vertex_buffer->at(command.index_buffer->at(id.triangle_id * 3 + i));
+        tri.vertices[i] = vertex_shader(VertIn{ .model_pos = unpack_position(vertex, command.quantization), .texcoord = unpack_texcoord(vertex, command.quantization) }, uniform);
     }
+
+    const glm::mat3 clip(
+        glm::vec3(tri.vertices[0].ndc_pos.x, tri.vertices[0].ndc_pos.y, tri.vertices[0].ndc_pos.w),
+        glm::vec3(tri.vertices[1].ndc_pos.x, tri.vertices[1].ndc_pos.y, tri.vertices[1].ndc_pos.w),
+        glm::vec3(tri.vertices[2].ndc_pos.x, tri.vertices[2].ndc_pos.y, tri.vertices[2].ndc_pos.w));
+    const float clip_det = glm::determinant(clip);
+    if (clip_det == 0.f) return tri;
+    tri.inv_clip = glm::inverse(clip);
+
+    // same winding as setup_triangle: screen space is y down, so a positive determinant is counter clock wise on screen
+    const bool is_ccw = clip_det > 0.f;
+    const bool is_swapped = command.cull_mode == CullMode::CLOCK_WISE || (command.cull_mode == CullMode::NONE && is_ccw);
+    const glm::vec3 p0 = tri.vertices[0].world_pos.xyz;
+    const glm::vec3 p1 = tri.vertices[1].world_pos.xyz;
+    const glm::vec3 p2 = tri.vertices[2].world_pos.xyz;
+    tri.world_norm = is_swapped ? glm::cross(p1 - p0, p2 - p0) : glm::cross(p2 - p0, p1 - p0);
+    tri.is_valid = true;
+    return tri;
+}
+
+glm::vec3 visible_barycentrics(const VisibleTriangle& tri, float ndc_x, float ndc_y){
+    const glm::vec3 l = tri.inv_clip * glm::vec3(ndc_x, ndc_y, 1.f);
+    return l / (l.x + l.y + l.z);
+}
+
+void Renderer::shade_visibility(FrameBuffer* frame_buffer, const std::vector<DrawCall>& draws, const ViewPort& viewport){
+    if (!frame_buffer->visibility_buffer_view.has_value() || !frame_buffer->color_buffer_view.has_value()) return;
+
+    const std::uint32_t x0 = viewport.x, x1 = std::min(viewport.x + viewport.width, get_width(frame_buffer));
+    const std::uint32_t y0 = viewport.y, y1 = std::min(viewport.y + viewport.height, get_height(frame_buffer));
+    if (x0 >= x1 || y0 >= y1) return;
+
+    // one pixel step in ndc
+    const float ndc_dx = 2.f / static_cast<float>(viewport.width);
+    const float ndc_dy = -2.f / static_cast<float>(viewport.height);
+
+    parallel_for(y1 - y0, [&](std::uint32_t row){
+        const std::uint32_t y = y0 + row;
+        VisibleTriangle tri;
+
+        for (std::uint32_t x = x0; x < x1; x++){
+            const VisibilityId id = frame_buffer->visibility_buffer_view->at(x, y);
+            if (id.draw_id >= draws.size()) continue;
+
+            // neighbouring pixels usually see the same triangle
+            if (tri.id.draw_id != id.draw_id || tri.id.triangle_id != id.triangle_id)
+                tri = load_visible_triangle(draws[id.draw_id], id);
+            if (!tri.is_valid) continue;
+
+            const DrawCall& command = draws[id.draw_id];
+            const Uniform uniform = {
+                .model_mat = command.world_transform,
+                .proj_view_mat = command.vp_transform,
+                .light_mat = command.light_mat,
+                .light_dir = command.light_direction,
+                .material = command.material,
+                .shadows = command.shadows,
+                .irradiance_volume = command.irradiance_volume,
+            };
+
+            const float ndc_x = (static_cast<float>(x - viewport.x) + 0.5f) * ndc_dx - 1.f;
+            const float ndc_y = 1.f + (static_cast<float>(y - viewport.y) + 0.5f) * ndc_dy;
+            const glm::vec3 l = visible_barycentrics(tri, ndc_x, ndc_y);
+            const glm::vec3 l_dx = visible_barycentrics(tri, ndc_x + ndc_dx, ndc_y);
+            const glm::vec3 l_dy = visible_barycentrics(tri, ndc_x, ndc_y + ndc_dy);
+
+            const auto& v = tri.vertices;
+            auto interpolate_texcoord = [&v](const glm::vec3& b){
+                return b.x * v[0].texcoord + b.y * v[1].texcoord + b.z * v[2].texcoord;
+            };
+            const glm::vec4 clip_pos = l.x * v[0].ndc_pos + l.y * v[1].ndc_pos + l.z * v[2].ndc_pos;
+
+            FragIn fragment{
+                .model_pos = l.x * v[0].model_pos + l.y * v[1].model_pos + l.z * v[2].model_pos,
+                .world_pos = l.x * v[0].world_pos + l.y * v[1].world_pos + l.z * v[2].world_pos,
+                .world_norm = tri.world_norm,
+                .ndc_pos = glm::vec4(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, clip_pos.z / clip_pos.w, 1.f / clip_pos.w),
+                .texcoord = interpolate_texcoord(l),
+            };
+            for (std::uint32_t i = 0; i < VARYING_COUNT; i++)
+                fragment.varyings[i] = l.x * v[0].varyings[i] + l.y * v[1].varyings[i] + l.z * v[2].varyings[i];
+            const glm::vec2 texcoord_dx = interpolate_texcoord(l_dx) - fragment.texcoord;
+            const glm::vec2 texcoord_dy = interpolate_texcoord(l_dy) - fragment.texcoord;
+
+            auto sample_texcoord0 = [&](Texture<R8G8B8A8_U>* tex){
+                return sample_texture(tex, fragment.texcoord, texcoord_dx, texcoord_dy);
+            };
+
+            glm::vec4 color = fragment_shader(fragment, uniform, sample_texcoord0).color;
+            frame_buffer->color_buffer_view->at(x, y) = to_r8g8b8a8_u(color);
+        }
+    });
 }
 
 std::uint32_t Renderer::bits_reverse( std::uint32_t v )
@@ -924,7 +1890,8 @@ std::uint32_t Renderer::bits_reverse( std::uint32_t v )
 }
 
 void Renderer::generate_mipmaps(Renderer::Texture<Renderer::R8G8B8A8_U>* texture){
-    if (texture->mipmaps.empty()) return;
+    // an image that failed to load has no texels to filter
+    if (texture->mipmaps.empty() || texture->mipmaps[0].width == 0 || texture->mipmaps[0].height == 0) return;
 
     texture->mipmaps.resize(1);
 
@@ -947,7 +1914,8 @@ void Renderer::generate_mipmaps(Renderer::Texture<Renderer::R8G8B8A8_U>* texture
             return to_vec4(prev_level.at(std::min(x, prev_level.width - 1), std::min(y, prev_level.height - 1)));
         };
 
-        for (std::uint32_t y = 0; y < new_height; y++){
+        // every level only reads the previous one, its rows are independent
+        parallel_for(new_height, [&](std::uint32_t y){
             for (std::uint32_t x = 0; x < new_width; x++){
                 glm::vec4 result(0.f, 0.f, 0.f, 0.f);
 
@@ -960,32 +1928,88 @@ void Renderer::generate_mipmaps(Renderer::Texture<Renderer::R8G8B8A8_U>* texture
 
                 next_level.at(x, y) = Renderer::to_r8g8b8a8_u(result);
             }
-        }
+        });
 
         texture->mipmaps.push_back(std::move(next_level));
     }
 }
 
+// takes ownership of the texels returned by stbi, a failed load gives an empty 0x0 image
+static Renderer::Image<Renderer::R8G8B8A8_U> to_image(stbi_uc* data, int width, int height){
+    if (data == nullptr) return Renderer::Image<Renderer::R8G8B8A8_U>{ .width = 0, .height = 0 };
+    const Renderer::R8G8B8A8_U* texels = reinterpret_cast<const Renderer::R8G8B8A8_U*>(data);
+    Renderer::Image<Renderer::R8G8B8A8_U> result {
+        .image = std::vector<Renderer::R8G8B8A8_U>(texels, texels + width * height),
+        .width = static_cast<std::uint32_t>(width),
+        .height = static_cast<std::uint32_t>(height),
+    };
+    stbi_image_free(data);
+    return result;
+}
+
 Renderer::Image<Renderer::R8G8B8A8_U> Renderer::load_image(std::filesystem::path const& path) {
-    uint32_t width, height;
+    int width = 0, height = 0;
     int channels;
     char path_char[1024];
     size_t size;
     wcstombs_s(&size, path_char, path.c_str(), path.string().size());
     // wcstombs(path_char, path.c_str(), path.string().size());
-    Renderer::R8G8B8A8_U* data = (Renderer::R8G8B8A8_U*) stbi_load(path_char, (int*)&width, (int*)&height, &channels, 4);
-    std::cout << "load file:" << path << ", size=" << width << "x" << height << std::endl;
-    Renderer::Image<Renderer::R8G8B8A8_U> result {
-        .image = std::vector<Renderer::R8G8B8A8_U>(data, data + width * height),
-        .width = width, 
-        .height = height,
-    };
+    stbi_uc* data = stbi_load(path_char, &width, &height, &channels, 4);
+    Renderer::Image<Renderer::R8G8B8A8_U> result = to_image(data, width, height);
+    std::cout << "load file:" << path << ", size=" << result.width << "x" << result.height << std::endl;
     return result;
 }
 
+Renderer::Image<Renderer::R8G8B8A8_U> Renderer::load_image_from_memory(const std::uint8_t* data, std::size_t size) {
+    int width = 0, height = 0;
+    int channels;
+    stbi_uc* texels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &channels, 4);
+    return to_image(texels, width, height);
+}
+
 Texture<R8G8B8A8_U> Renderer::load_texture(const std::filesystem::path& path) {
     Texture<R8G8B8A8_U> result{};
     result.mipmaps.push_back(load_image(path));
     generate_mipmaps(&result);
     return result;
-}
\ No newline at end of file
+}
+float Renderer::get_position_cell_size(const glm::vec3& extent){
+    // 65533 instead of 65535 leaves room for the bounds starting and ending off the grid
+    const float max_extent = std::max({ extent.x, extent.y, extent.z });
+    return max_extent > 0.f ? max_extent / 65533.f : 1.f;
+}
+
+std::vector<PackedVertex> Renderer::pack_vertices(const std::vector<Vertex>& vertices, float cell_size, VertexQuantization* quantization){
+    *quantization = VertexQuantization{};
+    if (vertices.empty()) return {};
+
+    glm::vec3 position_min(std::numeric_limits<float>::max()), position_max(std::numeric_limits<float>::lowest());
+    glm::vec2 texcoord_min(std::numeric_limits<float>::max()), texcoord_max(std::numeric_limits<float>::lowest());
+    for (const Vertex& vertex : vertices){
+        position_min = glm::min(position_min, glm::vec3(vertex.world_position));
+        position_max = glm::max(position_max, glm::vec3(vertex.world_position));
+        texcoord_min = glm::min(texcoord_min, vertex.texcoord0);
+        texcoord_max = glm::max(texcoord_max, vertex.texcoord0);
+    }
+
+    const float cell = std::max(cell_size, get_position_cell_size(position_max - position_min));
+    const glm::vec2 texcoord_range = texcoord_max - texcoord_min;
+    quantization->position_cell_size = cell;
+    quantization->position_origin = glm::floor(position_min / cell);
+    quantization->texcoord_min = texcoord_min;
+    quantization->texcoord_step = texcoord_range / 65535.f;
+
+    const glm::vec2 texcoord_scale(
+        texcoord_range.x > 0.f ? 65535.f / texcoord_range.x : 0.f,
+        texcoord_range.y > 0.f ? 65535.f / texcoord_range.y : 0.f);
+    std::vector<PackedVertex> result(vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); i++){
+        const glm::vec3 cells = glm::clamp(glm::round(glm::vec3(vertices[i].world_position) / cell) - quantization->position_origin, glm::vec3(0.f), glm::vec3(65535.f));
+        const glm::vec2 steps = glm::clamp(glm::round((vertices[i].texcoord0 - texcoord_min) * texcoord_scale), glm::vec2(0.f), glm::vec2(65535.f));
+        result[i] = PackedVertex{
+            .position = { static_cast<std::uint16_t>(cells.x), static_cast<std::uint16_t>(cells.y), static_cast<std::uint16_t>(cells.z) },
+            .texcoord0 = { static_cast<std::uint16_t>(steps.x), static_cast<std::uint16_t>(steps.y) },
+        };
+    }
+    return result;
+}
@@ -91,12 +91,49 @@ struct Texture {
     std::vector<Image<PixelType>> mipmaps;
 };
 
+// vertex of a mesh before it is packed, see pack_vertices
 struct Vertex {
-    glm::vec4 ndc_position;
     glm::vec2 texcoord0;
     glm::vec4 world_position;
 };
 
+// vertex as stored in a mesh, 10 bytes instead of the 24 of Vertex. the position is a 16 bit
+// coordinate on a grid and the texcoord a 16 bit fraction of the texcoord range of the mesh,
+// VertexQuantization holds what is needed to decode them. a half float texcoord would be no
+// better: its 11 bit mantissa gives a coarser step than the fraction anywhere but close to zero
+// (0.125 near 200 against 0.003 for a 0..200 range). both lose texel precision on meshes whose
+// texcoords span hundreds of repeats, about 3 texels of a 1024 texture at a range of 200.
+struct PackedVertex {
+    std::array<std::uint16_t, 3> position;
+    std::array<std::uint16_t, 2> texcoord0;
+};
+
+// position = (packed position + position_origin) * position_cell_size
+// texcoord = texcoord_min + packed texcoord * texcoord_step
+struct VertexQuantization {
+    glm::vec3 position_origin = glm::vec3(0.f); // whole cells, the low corner of the mesh bounds
+    float position_cell_size = 1.f;
+    glm::vec2 texcoord_min = glm::vec2(0.f);
+    glm::vec2 texcoord_step = glm::vec2(0.f);
+};
+
+inline glm::vec4 unpack_position(const PackedVertex& vertex, const VertexQuantization& quantization){
+    const glm::vec3 cells(vertex.position[0], vertex.position[1], vertex.position[2]);
+    return glm::vec4((cells + quantization.position_origin) * quantization.position_cell_size, 1.f);
+}
+
+inline glm::vec2 unpack_texcoord(const PackedVertex& vertex, const VertexQuantization& quantization){
+    return quantization.texcoord_min + glm::vec2(vertex.texcoord0[0], vertex.texcoord0[1]) * quantization.texcoord_step;
+}
+
+// smallest grid cell that fits bounds of the given extent into 16 bit coordinates
+float get_position_cell_size(const glm::vec3& extent);
+
+// packs vertices on a grid of cell_size, or of get_position_cell_size of their bounds when that
+// is bigger. meshes packed on the same grid decode equal positions to equal floats, so the
+// edges they share stay watertight.
+std::vector<PackedVertex> pack_vertices(const std::vector<Vertex>& vertices, float cell_size, VertexQuantization* quantization);
+
 struct Material {
     std::string name;
     glm::vec3 ambient;
@@ -110,8 +147,9 @@ struct Material {
 };
 
 struct Mesh{
-        std::vector<Renderer::Vertex> vertices;
+        std::vector<Renderer::PackedVertex> vertices;
         std::vector<std::uint32_t> indices;
+        Renderer::VertexQuantization quantization;
         Renderer::Material material;
 };
 
@@ -120,22 +158,84 @@ struct Scene{
     std::list<Renderer::Texture<Renderer::R8G8B8A8_U>> textures;
 };
 
+// counters filled in by draw_new, accumulated over every draw that points to the same DrawStats
+struct DrawStats{
+    std::uint64_t vertex_cache_lookups = 0; // one per index read by the geometry stage
+    std::uint64_t vertex_cache_hits = 0;    // lookups that reused an already shaded vertex
+
+    float vertex_cache_hit_rate() const {
+        return vertex_cache_lookups == 0 ? 0.f : static_cast<float>(vertex_cache_hits) / static_cast<float>(vertex_cache_lookups);
+    }
+};
+
+constexpr std::uint32_t MAX_SHADOW_CASCADES = 4;
+
+// one slice of a cascaded shadow map. proj takes light view space positions (DrawCall::light_mat
+// applied to a world position) to the clip space depth_map was rendered in.
+struct ShadowCascade{
+    glm::mat4 proj = glm::identity<glm::mat4>();
+    const Image<std::uint32_t>* depth_map = nullptr;
+};
+
+// cascades sorted from the nearest to the farthest. a fragment is looked up in the first cascade
+// that contains it and is lit when none does.
+struct ShadowCascades{
+    std::array<ShadowCascade, MAX_SHADOW_CASCADES> cascades;
+    std::uint32_t count = 0;
+};
+
+// 1 when the light view space position is in shadow, 0 when it is lit or shadows is null
+float shadow_value(const ShadowCascades* shadows, const glm::vec4& light_space_pos);
+
+// grid of probes holding the diffuse indirect light of the scene, see irradiance_volume.hpp
+struct IrradianceVolume;
+
+// trilinearly interpolated irradiance / pi of the volume at a world position for a surface with
+// the given normal, black when volume is null
+glm::vec3 sample_irradiance(const IrradianceVolume* volume, const glm::vec3& position, const glm::vec3& normal);
+
 struct DrawCall {
     CullMode cull_mode = CullMode::NONE;
     DepthSettings depth_settings = {};
-    std::vector<Vertex>* vertex_buffer = nullptr;
+    std::vector<PackedVertex>* vertex_buffer = nullptr;
     std::vector<std::uint32_t>* index_buffer = nullptr;
+    VertexQuantization quantization = {}; // of the vertices in vertex_buffer
     Material* material = nullptr;
     glm::mat4 world_transform = glm::identity<glm::mat4>();
     glm::mat4 vp_transform = glm::identity<glm::mat4>();
-    Image<std::uint32_t>* shadow_map;
-    glm::mat4 light_mat = glm::identity<glm::mat4>();
+    const ShadowCascades* shadows = nullptr;
+    glm::mat4 light_mat = glm::identity<glm::mat4>(); // world to light view space, shared by all cascades
     glm::vec3 light_direction;
+    const IrradianceVolume* irradiance_volume = nullptr;
+    std::uint32_t draw_id = 0; // written to the visibility buffer, index of this call in the list given to shade_visibility
+    DrawStats* stats = nullptr;
 };
 
+// triangle visible in a pixel of a visibility buffer. triangle_id is the index of the
+// triangle in the draw's index buffer (first index / 3).
+struct VisibilityId{
+    std::uint32_t draw_id;
+    std::uint32_t triangle_id;
+};
+constexpr VisibilityId EMPTY_VISIBILITY_ID = {UINT32_MAX, UINT32_MAX};
+
+// coarse max-depth buffer kept alongside depth_buffer_view. blocks holds the max depth of every
+// 8x8 pixel block and tiles the max of every 64x64 tile. draw_new uses it to reject occluded
+// triangles and blocks before interpolating anything (LESS and LESSEQUAL tests only) and keeps
+// it up to date as it writes depth with any test. it has to be cleared together with the depth buffer, see clear_depth.
+struct HiZBuffer{
+    Image<std::uint32_t> blocks;
+    Image<std::uint32_t> tiles;
+};
+HiZBuffer create_hiz_buffer(std::uint32_t width, std::uint32_t height);
+
 struct FrameBuffer{
     std::optional<ImageView<R8G8B8A8_U>> color_buffer_view;
     std::optional<ImageView<std::uint32_t>> depth_buffer_view;
+    // when set, draw_new only writes depth and the id of the visible triangle, and shading
+    // is deferred to shade_visibility which runs the fragment shader once per pixel
+    std::optional<ImageView<VisibilityId>> visibility_buffer_view;
+    HiZBuffer* hiz_buffer = nullptr;
 };
 std::uint32_t get_width(const FrameBuffer* fb);
 std::uint32_t get_height(const FrameBuffer* fb);
@@ -145,6 +245,9 @@ void clear(ImageView<PixelType>* image_view, const PixelType& color) {
     std::fill_n(image_view->image, image_view->width * image_view->height, color);
 }
 
+// clears the depth buffer and the hi-z buffer of frame_buffer, if it has them
+void clear_depth(FrameBuffer* frame_buffer, std::uint32_t depth);
+
 float det(glm::vec2 const& a, glm::vec2 const& b);
 
 using Plane = glm::vec4;
@@ -156,7 +259,8 @@ struct Uniform{
     const glm::mat4 light_mat;
     const glm::vec3 light_dir;
 	const Material* material;
-    const Image<std::uint32_t>* shadow_map;
+    const ShadowCascades* shadows;
+    const IrradianceVolume* irradiance_volume;
 };
 
 struct VertIn {
@@ -165,14 +269,28 @@ struct VertIn {
 	glm::vec2 texcoord;
 };
 
+// extra floats passed from vertex_shader to fragment_shader, interpolated perspective correctly
+// by the rasterizer. the shaders declare their layout with the VARYING_ slots below.
+constexpr std::uint32_t VARYING_LIGHT_SPACE_POS = 0; // vec4, light_mat * world_pos in light view space
+constexpr std::uint32_t VARYING_COUNT = 4;
+
 struct VertOut {
 	glm::vec4 model_pos;
 	glm::vec4 world_pos;
     glm::vec3 world_norm;
 	glm::vec4 ndc_pos;
 	glm::vec2 texcoord;
+    std::array<float, VARYING_COUNT> varyings;
 };
 
+inline glm::vec4 get_varying_vec4(const VertOut& v, std::uint32_t slot){
+    return glm::vec4(v.varyings[slot], v.varyings[slot + 1], v.varyings[slot + 2], v.varyings[slot + 3]);
+}
+
+inline void set_varying_vec4(VertOut* v, std::uint32_t slot, const glm::vec4& value){
+    for (std::uint32_t i = 0; i < 4; i++) v->varyings[slot + i] = value[i];
+}
+
 using FragIn = VertOut;
 
 struct FragOut {
@@ -181,16 +299,64 @@ struct FragOut {
 };
 
 VertOut vertex_shader(const VertIn& in, const Uniform& uniform);
-FragOut fragment_shader(const FragIn& in, const Uniform& uniform, const std::function<glm::vec4(Texture<R8G8B8A8_U>*)>);
+
+// the sampler is called with a texture and returns its filtered value at the fragment. it is a
+// template parameter so the rasterizer can inline it instead of calling through a std::function
+template<typename SampleTex0>
+FragOut fragment_shader(const FragIn& in, const Uniform& uniform, const SampleTex0& samplet_tex0) {
+	FragOut out{
+		.color = glm::vec4(1.f, 1.f, 1.f, 1.f),
+        .depth = 0,
+	};
+
+    float shadow = shadow_value(uniform.shadows, get_varying_vec4(in, VARYING_LIGHT_SPACE_POS));
+
+    auto light_dot = glm::dot(-uniform.light_dir, glm::normalize(in.world_norm));
+    if (light_dot < 0.f) light_dot = 0.f;
+    // light_dot = light_dot * 0.5f + 0.5f;
+
+    auto light_intensity =  light_dot;
+
+    glm::vec4 albedo = glm::vec4(uniform.material->diffuse, 1.f);
+    if (uniform.material->diffuse_tex)
+        albedo = samplet_tex0(uniform.material->diffuse_tex);
+    
+    auto light_diffuse = glm::vec4(1.f) * (1.f - shadow) * albedo / 3.14f * light_intensity;
+    auto indirect_diffuse = albedo * glm::vec4(sample_irradiance(uniform.irradiance_volume, glm::vec3(in.world_pos), glm::normalize(in.world_norm)), 0.f);
+    out.color = light_diffuse + indirect_diffuse;
+
+    return out;
+}
 
 void draw(FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport);
 
 void draw_new(FrameBuffer* frame_buffer, const DrawCall& command, const ViewPort& viewport);
 
+// one output of draw_multiview, e.g. a cube map face, an eye or a camera
+struct View{
+    FrameBuffer* frame_buffer;
+    glm::mat4 vp_transform;
+    ViewPort viewport;
+};
+
+// draw_new into several views at once. every vertex is shaded once in world space and every
+// triangle is only projected, set up and rasterized in the views whose frustum it overlaps.
+// the views are rasterized in parallel, so they must not share a frame buffer.
+// command.vp_transform is ignored, each view brings its own.
+void draw_multiview(const std::vector<View>& views, const DrawCall& command);
+
+// second pass of visibility buffer rendering. reconstructs the attributes of the triangle
+// stored in every pixel of frame_buffer's visibility buffer and shades it into the color buffer.
+// draws[i] must be the call that was drawn with draw_id = i.
+void shade_visibility(FrameBuffer* frame_buffer, const std::vector<DrawCall>& draws, const ViewPort& viewport);
+
 std::uint32_t bits_reverse( std::uint32_t v );
 
 Renderer::Image<Renderer::R8G8B8A8_U> load_image(std::filesystem::path const& path);
 
+// decodes an image file that was already read into memory, a failed decode gives a 0x0 image
+Renderer::Image<Renderer::R8G8B8A8_U> load_image_from_memory(const std::uint8_t* data, std::size_t size);
+
 void generate_mipmaps(Renderer::Texture<Renderer::R8G8B8A8_U>* texture);
  
 Texture<R8G8B8A8_U> load_texture(const std::filesystem::path& path);
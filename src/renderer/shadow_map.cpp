@@ -0,0 +1,223 @@
+#include "shadow_map.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace Renderer;
+
+namespace {
+// light directions closer than this (cosine) reuse the cached maps
+constexpr float LIGHT_DIRECTION_EPSILON = 0.99999f;
+// added in front of and behind the casters so their nearest and farthest faces are not clipped
+constexpr float DEPTH_PADDING = 1.f;
+
+struct LightBounds{
+    glm::vec3 min, max;
+};
+
+LightBounds to_light_bounds(const glm::mat4& light_view, const glm::vec3& bounds_min, const glm::vec3& bounds_max){
+    LightBounds bounds{ .min = glm::vec3(FLT_MAX), .max = glm::vec3(-FLT_MAX) };
+    for (std::uint32_t i = 0; i < 8; i++){
+        const glm::vec3 corner(
+            i & 1 ? bounds_max.x : bounds_min.x,
+            i & 2 ? bounds_max.y : bounds_min.y,
+            i & 4 ? bounds_max.z : bounds_min.z);
+        const glm::vec3 p = glm::vec3(light_view * glm::vec4(corner, 1.f));
+        bounds.min = glm::min(bounds.min, p);
+        bounds.max = glm::max(bounds.max, p);
+    }
+    return bounds;
+}
+
+bool overlaps(const ShadowCascadeState& state, const LightBounds& bounds){
+    return bounds.max.x >= state.center.x - state.half_size && bounds.min.x <= state.center.x + state.half_size
+        && bounds.max.y >= state.center.y - state.half_size && bounds.min.y <= state.center.y + state.half_size;
+}
+
+// distance from the camera to the far end of every cascade, splits[0] is the near plane
+std::array<float, MAX_SHADOW_CASCADES + 1> split_distances(const CascadedShadowSettings& settings, float near_plane, std::uint32_t count){
+    std::array<float, MAX_SHADOW_CASCADES + 1> splits{};
+    splits[0] = near_plane;
+    for (std::uint32_t i = 1; i <= count; i++){
+        const float t = static_cast<float>(i) / static_cast<float>(count);
+        const float log_split = near_plane * std::pow(settings.max_distance / near_plane, t);
+        const float uniform_split = near_plane + (settings.max_distance - near_plane) * t;
+        splits[i] = settings.split_lambda * log_split + (1.f - settings.split_lambda) * uniform_split;
+    }
+    return splits;
+}
+
+void render_cascade(CascadedShadowMap* shadow_map, ShadowCascadeState* state, const std::vector<ShadowCaster>& casters, const std::vector<LightBounds>& caster_bounds){
+    const std::uint32_t resolution = shadow_map->settings.resolution;
+    state->proj = glm::ortho(
+        state->center.x - state->half_size, state->center.x + state->half_size,
+        state->center.y - state->half_size, state->center.y + state->half_size,
+        shadow_map->near_plane, shadow_map->far_plane);
+
+    FrameBuffer frame_buffer = {
+        .color_buffer_view = std::nullopt,
+        .depth_buffer_view = create_imageview(state->depth_map, resolution, resolution),
+        .hiz_buffer = &state->hiz_buffer,
+    };
+    clear_depth(&frame_buffer, 0xFFFFFFFF);
+
+    const ViewPort viewport = { .x = 0, .y = 0, .width = resolution, .height = resolution };
+    for (std::size_t i = 0; i < casters.size(); i++){
+        if (!overlaps(*state, caster_bounds[i])) continue;
+        draw_new(
+            &frame_buffer,
+            {
+                .cull_mode = CullMode::CLOCK_WISE,
+                .depth_settings = {
+                    .write = true,
+                    .test_mode = DepthTestMode::LESS,
+                },
+                .vertex_buffer = casters[i].vertex_buffer,
+                .index_buffer = casters[i].index_buffer,
+                .quantization = casters[i].quantization,
+                .material = nullptr,
+                .world_transform = casters[i].world_transform,
+                .vp_transform = state->proj * shadow_map->light_view,
+            },
+            viewport
+        );
+    }
+
+    state->valid = true;
+    state->dirty = false;
+    state->last_update = shadow_map->frame;
+    shadow_map->rendered_cascades++;
+}
+}
+
+ShadowCaster Renderer::create_shadow_caster(std::vector<PackedVertex>* vertex_buffer, std::vector<std::uint32_t>* index_buffer, const VertexQuantization& quantization, const glm::mat4& world_transform){
+    ShadowCaster caster{
+        .vertex_buffer = vertex_buffer,
+        .index_buffer = index_buffer,
+        .quantization = quantization,
+        .world_transform = world_transform,
+        .bounds_min = glm::vec3(FLT_MAX),
+        .bounds_max = glm::vec3(-FLT_MAX),
+    };
+    for (const PackedVertex& vertex : *vertex_buffer){
+        const glm::vec3 p = glm::vec3(world_transform * unpack_position(vertex, quantization));
+        caster.bounds_min = glm::min(caster.bounds_min, p);
+        caster.bounds_max = glm::max(caster.bounds_max, p);
+    }
+    return caster;
+}
+
+CascadedShadowMap Renderer::create_cascaded_shadow_map(const CascadedShadowSettings& settings){
+    CascadedShadowMap shadow_map{ .settings = settings };
+    if (settings.fit_to_casters) shadow_map.settings.cascade_count = 1;
+    shadow_map.settings.cascade_count = std::clamp<std::uint32_t>(shadow_map.settings.cascade_count, 1, MAX_SHADOW_CASCADES);
+
+    for (std::uint32_t i = 0; i < shadow_map.settings.cascade_count; i++){
+        shadow_map.states[i].depth_map = Image<std::uint32_t>{
+            .image = std::vector<std::uint32_t>(settings.resolution * settings.resolution, 0xFFFFFFFF),
+            .width = settings.resolution,
+            .height = settings.resolution,
+        };
+        shadow_map.states[i].hiz_buffer = create_hiz_buffer(settings.resolution, settings.resolution);
+    }
+    return shadow_map;
+}
+
+void Renderer::update_cascaded_shadow_map(CascadedShadowMap* shadow_map, const std::vector<ShadowCaster>& casters, const ShadowCamera& camera, const glm::vec3& light_dir){
+    const CascadedShadowSettings& settings = shadow_map->settings;
+    const std::uint32_t count = settings.cascade_count;
+    shadow_map->frame++;
+    shadow_map->rendered_cascades = 0;
+
+    // every map depends on the light direction and the set of casters
+    const glm::vec3 direction = glm::normalize(light_dir);
+    if (glm::dot(direction, shadow_map->light_dir) < LIGHT_DIRECTION_EPSILON || casters.size() != shadow_map->caster_count){
+        const glm::vec3 up = std::abs(direction.x) < 0.99f ? glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+        shadow_map->light_dir = direction;
+        shadow_map->light_view = glm::lookAt(glm::vec3(0.f), direction, up);
+        shadow_map->caster_count = casters.size();
+        for (auto& state : shadow_map->states) state.valid = false;
+    }
+
+    std::vector<LightBounds> caster_bounds(casters.size());
+    LightBounds scene_bounds{ .min = glm::vec3(FLT_MAX), .max = glm::vec3(-FLT_MAX) };
+    for (std::size_t i = 0; i < casters.size(); i++){
+        caster_bounds[i] = to_light_bounds(shadow_map->light_view, casters[i].bounds_min, casters[i].bounds_max);
+        scene_bounds.min = glm::min(scene_bounds.min, caster_bounds[i].min);
+        scene_bounds.max = glm::max(scene_bounds.max, caster_bounds[i].max);
+    }
+    if (casters.empty()) scene_bounds = LightBounds{ .min = glm::vec3(-1.f), .max = glm::vec3(1.f) };
+
+    // the depth range is shared by all cascades so the depth bias means the same in each of them
+    const float near_plane = -scene_bounds.max.z - DEPTH_PADDING;
+    const float far_plane = -scene_bounds.min.z + DEPTH_PADDING;
+    if (near_plane != shadow_map->near_plane || far_plane != shadow_map->far_plane){
+        shadow_map->near_plane = near_plane;
+        shadow_map->far_plane = far_plane;
+        for (auto& state : shadow_map->states) state.valid = false;
+    }
+
+    const glm::mat4 inv_view = glm::inverse(camera.view_mat);
+    const auto splits = split_distances(settings, camera.near_plane, count);
+    const float tan_half_fov = std::tan(camera.fov_y * 0.5f);
+
+    for (std::uint32_t i = 0; i < count; i++){
+        ShadowCascadeState& state = shadow_map->states[i];
+
+        // the square this cascade wants to cover and whether the cached one still does
+        glm::vec2 center;
+        float half_size;
+        bool refit;
+        if (settings.fit_to_casters){
+            center = (glm::vec2(scene_bounds.min) + glm::vec2(scene_bounds.max)) * 0.5f;
+            half_size = std::max(scene_bounds.max.x - scene_bounds.min.x, scene_bounds.max.y - scene_bounds.min.y) * 0.5f;
+            refit = !state.valid || center != state.center || half_size != state.half_size;
+        } else {
+            // bounding sphere of the frustum slice, its radius only depends on the projection so
+            // it does not change as the camera turns
+            const float near_z = splits[i], far_z = splits[i + 1];
+            const float center_z = (near_z + far_z) * 0.5f;
+            const float near_extent = near_z * tan_half_fov, far_extent = far_z * tan_half_fov;
+            const float radius = std::sqrt(std::max(
+                near_extent * near_extent * (1.f + camera.aspect * camera.aspect) + (center_z - near_z) * (center_z - near_z),
+                far_extent * far_extent * (1.f + camera.aspect * camera.aspect) + (far_z - center_z) * (far_z - center_z)));
+            const glm::vec4 world_center = inv_view * glm::vec4(0.f, 0.f, -center_z, 1.f);
+            const glm::vec2 light_center = glm::vec2(shadow_map->light_view * world_center);
+
+            // snap to whole texels so maps rendered from different centers line up
+            half_size = std::ceil(radius * (1.f + settings.margin) * 16.f) / 16.f;
+            const float texel_size = 2.f * half_size / static_cast<float>(settings.resolution);
+            center = glm::floor(light_center / texel_size + 0.5f) * texel_size;
+
+            const glm::vec2 offset = glm::abs(light_center - state.center);
+            refit = !state.valid || half_size != state.half_size
+                || std::max(offset.x, offset.y) + radius > state.half_size;
+        }
+
+        if (!refit && !state.dirty) continue;
+        // far cascades cover more of the screen per texel, a few frames of lag there is not visible
+        if (state.valid && shadow_map->frame - state.last_update < settings.update_intervals[i]) continue;
+
+        if (refit){
+            state.center = center;
+            state.half_size = half_size;
+        }
+        render_cascade(shadow_map, &state, casters, caster_bounds);
+    }
+
+    shadow_map->cascades.count = count;
+    for (std::uint32_t i = 0; i < count; i++){
+        shadow_map->cascades.cascades[i] = ShadowCascade{
+            .proj = shadow_map->states[i].proj,
+            .depth_map = &shadow_map->states[i].depth_map,
+        };
+    }
+}
+
+void Renderer::invalidate_cascaded_shadow_map(CascadedShadowMap* shadow_map, const glm::vec3& bounds_min, const glm::vec3& bounds_max){
+    const LightBounds bounds = to_light_bounds(shadow_map->light_view, bounds_min, bounds_max);
+    for (std::uint32_t i = 0; i < shadow_map->settings.cascade_count; i++){
+        ShadowCascadeState& state = shadow_map->states[i];
+        if (state.valid && overlaps(state, bounds)) state.dirty = true;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "renderer.hpp"
+
+namespace Renderer{
+struct CascadedShadowSettings{
+    std::uint32_t cascade_count = 4;
+    std::uint32_t resolution = 1024;
+    float max_distance = 50.f; // view distance covered by the last cascade
+    float split_lambda = 0.75f; // blend between logarithmic (1) and uniform (0) split distances
+    // a fitted cascade covers this fraction more than its frustum slice so that small camera
+    // moves keep using the cached map
+    float margin = 0.25f;
+    // once it holds a valid map, cascade i is re-rendered at most every update_intervals[i] frames
+    std::array<std::uint32_t, MAX_SHADOW_CASCADES> update_intervals = {1, 1, 2, 4};
+    // when set the first cascade covers every caster instead of following the camera, for
+    // passes that look in all directions like the light probe bake
+    bool fit_to_casters = false;
+};
+
+// the camera the cascades are fitted to
+struct ShadowCamera{
+    glm::mat4 view_mat;
+    float fov_y; // radians
+    float aspect;
+    float near_plane;
+};
+
+struct ShadowCaster{
+    std::vector<PackedVertex>* vertex_buffer = nullptr;
+    std::vector<std::uint32_t>* index_buffer = nullptr;
+    VertexQuantization quantization = {};
+    glm::mat4 world_transform = glm::identity<glm::mat4>();
+    glm::vec3 bounds_min; // world space
+    glm::vec3 bounds_max;
+};
+ShadowCaster create_shadow_caster(std::vector<PackedVertex>* vertex_buffer, std::vector<std::uint32_t>* index_buffer, const VertexQuantization& quantization, const glm::mat4& world_transform);
+
+struct ShadowCascadeState{
+    Image<std::uint32_t> depth_map;
+    HiZBuffer hiz_buffer;
+    glm::mat4 proj = glm::identity<glm::mat4>();
+    glm::vec2 center{0.f}; // light view space center of the square the map covers
+    float half_size = 0.f;
+    bool valid = false; // the map was rendered with the current light and caster depth range
+    bool dirty = false; // casters inside the map changed since it was rendered
+    std::uint64_t last_update = 0;
+};
+
+// shadow cascades that are only re-rendered when the light, their bounds or the casters inside
+// them change. draws sample them through cascades and light_view.
+struct CascadedShadowMap{
+    CascadedShadowSettings settings;
+    std::array<ShadowCascadeState, MAX_SHADOW_CASCADES> states;
+    ShadowCascades cascades;
+    glm::mat4 light_view = glm::identity<glm::mat4>(); // see DrawCall::light_mat
+    glm::vec3 light_dir{0.f};
+    float near_plane = 0.f, far_plane = 0.f; // light view depth range of the casters
+    std::size_t caster_count = 0;
+    std::uint64_t frame = 0;
+    std::uint32_t rendered_cascades = 0; // cascades re-rendered by the last update
+};
+CascadedShadowMap create_cascaded_shadow_map(const CascadedShadowSettings& settings);
+
+// fits the cascades to camera and re-renders the ones that are out of date
+void update_cascaded_shadow_map(CascadedShadowMap* shadow_map, const std::vector<ShadowCaster>& casters, const ShadowCamera& camera, const glm::vec3& light_dir);
+
+// marks the cascades overlapping a world space box as out of date. call it with the old and the
+// new bounds of geometry that moved.
+void invalidate_cascaded_shadow_map(CascadedShadowMap* shadow_map, const glm::vec3& bounds_min, const glm::vec3& bounds_max);
+}
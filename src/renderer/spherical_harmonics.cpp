@@ -0,0 +1,95 @@
+#include "spherical_harmonics.hpp"
+#include "job_system.hpp"
+#include "glm/gtc/constants.hpp"
+
+using namespace Renderer;
+
+std::array<float, 9> Renderer::sh9_basis(const glm::vec3& d){
+    return {
+        0.282095f,
+        0.488603f * d.y,
+        0.488603f * d.z,
+        0.488603f * d.x,
+        1.092548f * d.x * d.y,
+        1.092548f * d.y * d.z,
+        0.315392f * (3.f * d.z * d.z - 1.f),
+        1.092548f * d.x * d.z,
+        0.546274f * (d.x * d.x - d.y * d.y),
+    };
+}
+
+glm::vec3 Renderer::evaluate_sh9(const SH9& sh, const glm::vec3& direction){
+    const auto basis = sh9_basis(direction);
+    glm::vec3 result(0.f);
+    for (std::uint32_t i = 0; i < 9; i++) result += sh.coefficients[i] * basis[i];
+    return result;
+}
+
+glm::vec3 Renderer::cube_texel_direction(const glm::mat4& inv_view_proj, std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height){
+    // same pixel centers and y flip as the viewport transform
+    const float ndc_x = (static_cast<float>(x) + 0.5f) / static_cast<float>(width) * 2.f - 1.f;
+    const float ndc_y = 1.f - (static_cast<float>(y) + 0.5f) / static_cast<float>(height) * 2.f;
+    glm::vec4 near_pos = inv_view_proj * glm::vec4(ndc_x, ndc_y, -1.f, 1.f);
+    glm::vec4 far_pos = inv_view_proj * glm::vec4(ndc_x, ndc_y, 1.f, 1.f);
+    near_pos /= near_pos.w;
+    far_pos /= far_pos.w;
+    return glm::normalize(glm::vec3(far_pos - near_pos));
+}
+
+SH9 Renderer::project_cube_map(const std::array<const Image<R8G8B8A8_U>*, 6>& faces, const std::array<glm::mat4, 6>& view_proj){
+    std::array<glm::mat4, 6> inv_view_proj;
+    for (std::uint32_t i = 0; i < 6; i++) inv_view_proj[i] = glm::inverse(view_proj[i]);
+
+    // every row is summed on its own and the rows are added up in order afterwards, so the
+    // result does not depend on how the rows were scheduled
+    struct RowSum{
+        SH9 sh;
+        float weight = 0.f;
+    };
+    const std::uint32_t rows = faces[0]->height;
+    std::vector<RowSum> row_sums(6 * rows);
+
+    parallel_for(6 * rows, [&](std::uint32_t row){
+        const std::uint32_t face = row / rows, y = row % rows;
+        const Image<R8G8B8A8_U>& image = *faces[face];
+        RowSum& sum = row_sums[row];
+
+        const float v = 1.f - (static_cast<float>(y) + 0.5f) / static_cast<float>(image.height) * 2.f;
+        for (std::uint32_t x = 0; x < image.width; x++){
+            // solid angle of the texel, dA / (1 + u^2 + v^2)^(3/2) on a face at distance 1
+            const float u = (static_cast<float>(x) + 0.5f) / static_cast<float>(image.width) * 2.f - 1.f;
+            const float r2 = 1.f + u * u + v * v;
+            const float weight = 1.f / (r2 * std::sqrt(r2));
+
+            const glm::vec3 direction = cube_texel_direction(inv_view_proj[face], x, y, image.width, image.height);
+            const glm::vec3 radiance = glm::vec3(to_vec4(image.at(x, y))) * weight;
+            const auto basis = sh9_basis(direction);
+            for (std::uint32_t i = 0; i < 9; i++) sum.sh.coefficients[i] += radiance * basis[i];
+            sum.weight += weight;
+        }
+    });
+
+    SH9 result;
+    float total_weight = 0.f;
+    for (const RowSum& sum : row_sums){
+        for (std::uint32_t i = 0; i < 9; i++) result.coefficients[i] += sum.sh.coefficients[i];
+        total_weight += sum.weight;
+    }
+    // the weights of a whole cube add up to 4 pi, normalizing by their sum removes the
+    // discretization error
+    const float scale = total_weight > 0.f ? 4.f * glm::pi<float>() / total_weight : 0.f;
+    for (auto& coefficient : result.coefficients) coefficient *= scale;
+    return result;
+}
+
+SH9 Renderer::radiance_to_irradiance(const SH9& radiance){
+    // cosine lobe band factors A_l (Ramamoorthi and Hanrahan) divided by pi
+    constexpr std::array<float, 9> band_scale = {
+        1.f,
+        2.f / 3.f, 2.f / 3.f, 2.f / 3.f,
+        0.25f, 0.25f, 0.25f, 0.25f, 0.25f,
+    };
+    SH9 irradiance;
+    for (std::uint32_t i = 0; i < 9; i++) irradiance.coefficients[i] = radiance.coefficients[i] * band_scale[i];
+    return irradiance;
+}
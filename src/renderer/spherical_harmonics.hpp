@@ -0,0 +1,26 @@
+#pragma once
+
+#include "renderer.hpp"
+
+namespace Renderer{
+// order 2 (L2) spherical harmonics, one rgb coefficient per basis function
+struct SH9{
+    std::array<glm::vec3, 9> coefficients{};
+};
+
+// the 9 real basis functions evaluated at a normalized direction
+std::array<float, 9> sh9_basis(const glm::vec3& direction);
+
+glm::vec3 evaluate_sh9(const SH9& sh, const glm::vec3& direction);
+
+// direction through the center of texel (x, y) of a cube face rendered with view_proj
+glm::vec3 cube_texel_direction(const glm::mat4& inv_view_proj, std::uint32_t x, std::uint32_t y, std::uint32_t width, std::uint32_t height);
+
+// projects the radiance of a cube map, every texel weighted by the solid angle it covers.
+// faces[i] must have been rendered with view_proj[i]. runs in parallel over faces and rows.
+SH9 project_cube_map(const std::array<const Image<R8G8B8A8_U>*, 6>& faces, const std::array<glm::mat4, 6>& view_proj);
+
+// convolves radiance with the clamped cosine lobe. evaluating the result at a normal gives
+// irradiance / pi, the radiance leaving a white lambertian surface.
+SH9 radiance_to_irradiance(const SH9& radiance);
+}
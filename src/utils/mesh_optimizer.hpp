@@ -0,0 +1,209 @@
+#pragma once
+
+#include "renderer/renderer.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+namespace MeshOptimizer{
+    // modeled fifo size for optimize_vertex_cache, draw_new's cache is bigger but resets every batch
+    constexpr std::uint32_t CACHE_SIZE = 32;
+
+    struct VertexKey{
+        std::array<std::uint16_t, 5> bits; // packed position xyz and texcoord
+
+        bool operator==(const VertexKey& other) const { return bits == other.bits; }
+    };
+
+    struct VertexKeyHash{
+        std::size_t operator()(const VertexKey& key) const {
+            std::uint64_t hash = 1469598103934665603ull;
+            for (const std::uint16_t v : key.bits) hash = (hash ^ v) * 1099511628211ull;
+            return static_cast<std::size_t>(hash);
+        }
+    };
+
+    inline VertexKey get_vertex_key(const Renderer::PackedVertex& vertex){
+        return VertexKey{ .bits = { vertex.position[0], vertex.position[1], vertex.position[2], vertex.texcoord0[0], vertex.texcoord0[1] } };
+    }
+
+    // merges vertices that packed to the same position and texcoord and points the indices at the survivors
+    inline void weld_vertices(Renderer::Mesh* mesh){
+        std::unordered_map<VertexKey, std::uint32_t, VertexKeyHash> unique_vertices;
+        unique_vertices.reserve(mesh->vertices.size());
+
+        std::vector<Renderer::PackedVertex> vertices;
+        std::vector<std::uint32_t> remap(mesh->vertices.size());
+        for (std::size_t i = 0; i < mesh->vertices.size(); i++){
+            const auto [it, is_new] = unique_vertices.try_emplace(get_vertex_key(mesh->vertices[i]), static_cast<std::uint32_t>(vertices.size()));
+            if (is_new) vertices.push_back(mesh->vertices[i]);
+            remap[i] = it->second;
+        }
+        for (std::uint32_t& index : mesh->indices) index = remap[index];
+        mesh->vertices = std::move(vertices);
+    }
+
+    // triangle order for a fifo post-transform cache of cache_size vertices, tipsify from
+    // "fast triangle reordering for vertex locality and reduced overdraw" (sander et al. 2007).
+    // fans around one vertex at a time and moves on to the neighbour that is still in the cache
+    // with the fewest triangles left. cluster_starts receives the first triangle of every run that
+    // starts with an empty cache, these runs can be reordered without losing locality.
+    inline std::vector<std::uint32_t> optimize_vertex_cache(const std::vector<std::uint32_t>& indices, std::uint32_t vertex_count,
+                                                            std::vector<std::uint32_t>* cluster_starts, std::uint32_t cache_size = CACHE_SIZE){
+        const std::uint32_t triangle_count = static_cast<std::uint32_t>(indices.size() / 3);
+        std::vector<std::uint32_t> result;
+        result.reserve(triangle_count * 3);
+        cluster_starts->clear();
+        if (triangle_count == 0) return result;
+
+        // triangles of every vertex, adjacency[offsets[v], offsets[v + 1])
+        std::vector<std::uint32_t> live(vertex_count, 0);
+        for (const std::uint32_t index : indices) live[index]++;
+        std::vector<std::uint32_t> offsets(vertex_count + 1, 0);
+        std::inclusive_scan(live.begin(), live.end(), offsets.begin() + 1);
+        std::vector<std::uint32_t> adjacency(indices.size());
+        std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (std::uint32_t i = 0; i < indices.size(); i++) adjacency[fill[indices[i]]++] = i / 3;
+
+        std::vector<std::uint32_t> cache_time(vertex_count, 0);
+        std::vector<std::uint8_t> is_emitted(triangle_count, 0);
+        std::vector<std::uint32_t> dead_ends;
+        std::vector<std::uint32_t> candidates;
+        std::uint32_t time = cache_size + 1;
+        std::uint32_t cursor = 0;
+
+        // vertices whose triangles were emitted most recently first, then the next unfinished one in index order
+        auto skip_dead_end = [&]() -> std::int64_t {
+            while (!dead_ends.empty()){
+                const std::uint32_t v = dead_ends.back();
+                dead_ends.pop_back();
+                if (live[v] > 0) return v;
+            }
+            for (; cursor < vertex_count; cursor++)
+                if (live[cursor] > 0) return cursor;
+            return -1;
+        };
+
+        std::int64_t fan = indices[0];
+        bool is_restart = true;
+        while (fan >= 0){
+            candidates.clear();
+            for (std::uint32_t i = offsets[fan]; i < offsets[fan + 1]; i++){
+                const std::uint32_t triangle = adjacency[i];
+                if (is_emitted[triangle]) continue;
+                if (is_restart) cluster_starts->push_back(static_cast<std::uint32_t>(result.size() / 3));
+                is_restart = false;
+
+                for (std::uint32_t k = 0; k < 3; k++){
+                    const std::uint32_t v = indices[triangle * 3 + k];
+                    result.push_back(v);
+                    dead_ends.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cache_time[v] > cache_size) cache_time[v] = time++;
+                }
+                is_emitted[triangle] = 1;
+            }
+
+            // the candidate that stays in the cache longest while its remaining triangles are emitted
+            std::int64_t best = -1;
+            std::int64_t best_priority = -1;
+            for (const std::uint32_t v : candidates){
+                if (live[v] == 0) continue;
+                std::int64_t priority = 0;
+                if (time - cache_time[v] + 2 * live[v] <= cache_size) priority = time - cache_time[v];
+                if (priority > best_priority){
+                    best_priority = priority;
+                    best = v;
+                }
+            }
+            // a restart at a vertex that already left the cache shares nothing with what came before
+            if (best < 0){
+                best = skip_dead_end();
+                is_restart = best >= 0 && time - cache_time[best] > cache_size;
+            }
+            fan = best;
+        }
+        return result;
+    }
+
+    // reorders the clusters found by optimize_vertex_cache so that the ones facing away from the
+    // middle of the mesh come first. they are the most likely to hide the others from any view
+    // point, so later clusters fail the depth test instead of being shaded and overwritten.
+    // front faces are counter clockwise.
+    inline std::vector<std::uint32_t> optimize_overdraw(const std::vector<std::uint32_t>& indices, const std::vector<Renderer::PackedVertex>& vertices,
+                                                       const Renderer::VertexQuantization& quantization, const std::vector<std::uint32_t>& cluster_starts){
+        const std::uint32_t triangle_count = static_cast<std::uint32_t>(indices.size() / 3);
+        const std::uint32_t cluster_count = static_cast<std::uint32_t>(cluster_starts.size());
+        if (cluster_count < 2) return indices;
+
+        auto position = [&](std::uint32_t triangle, std::uint32_t k){
+            return glm::vec3(Renderer::unpack_position(vertices[indices[triangle * 3 + k]], quantization));
+        };
+
+        // area weighted centroid and normal of every cluster and of the whole mesh
+        std::vector<glm::vec3> centroids(cluster_count, glm::vec3(0.f));
+        std::vector<glm::vec3> normals(cluster_count, glm::vec3(0.f));
+        std::vector<float> areas(cluster_count, 0.f);
+        glm::vec3 mesh_centroid(0.f);
+        float mesh_area = 0.f;
+        for (std::uint32_t c = 0; c < cluster_count; c++){
+            const std::uint32_t end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+            for (std::uint32_t t = cluster_starts[c]; t < end; t++){
+                const glm::vec3 p0 = position(t, 0), p1 = position(t, 1), p2 = position(t, 2);
+                const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                const float area = glm::length(normal);
+                centroids[c] += (p0 + p1 + p2) * (area / 3.f);
+                normals[c] += normal;
+                areas[c] += area;
+            }
+            mesh_centroid += centroids[c];
+            mesh_area += areas[c];
+        }
+        if (mesh_area > 0.f) mesh_centroid /= mesh_area;
+
+        std::vector<float> sort_keys(cluster_count, 0.f);
+        for (std::uint32_t c = 0; c < cluster_count; c++){
+            if (areas[c] <= 0.f) continue;
+            const float normal_length = glm::length(normals[c]);
+            if (normal_length > 0.f) sort_keys[c] = glm::dot(centroids[c] / areas[c] - mesh_centroid, normals[c] / normal_length);
+        }
+
+        std::vector<std::uint32_t> order(cluster_count);
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b){ return sort_keys[a] > sort_keys[b]; });
+
+        std::vector<std::uint32_t> result;
+        result.reserve(indices.size());
+        for (const std::uint32_t c : order){
+            const std::uint32_t end = c + 1 < cluster_count ? cluster_starts[c + 1] : triangle_count;
+            result.insert(result.end(), indices.begin() + cluster_starts[c] * 3, indices.begin() + end * 3);
+        }
+        return result;
+    }
+
+    // renumbers the vertices in the order the indices first use them, so vertices used together
+    // are next to each other in memory. vertices no index uses are dropped.
+    inline void optimize_vertex_fetch(Renderer::Mesh* mesh){
+        std::vector<std::uint32_t> remap(mesh->vertices.size(), UINT32_MAX);
+        std::vector<Renderer::PackedVertex> vertices;
+        vertices.reserve(mesh->vertices.size());
+        for (std::uint32_t& index : mesh->indices){
+            if (remap[index] == UINT32_MAX){
+                remap[index] = static_cast<std::uint32_t>(vertices.size());
+                vertices.push_back(mesh->vertices[index]);
+            }
+            index = remap[index];
+        }
+        mesh->vertices = std::move(vertices);
+    }
+
+    inline void optimize_mesh(Renderer::Mesh* mesh){
+        weld_vertices(mesh);
+        std::vector<std::uint32_t> cluster_starts;
+        const std::vector<std::uint32_t> cache_order = optimize_vertex_cache(mesh->indices, static_cast<std::uint32_t>(mesh->vertices.size()), &cluster_starts);
+        mesh->indices = optimize_overdraw(cache_order, mesh->vertices, mesh->quantization, cluster_starts);
+        optimize_vertex_fetch(mesh);
+    }
+}
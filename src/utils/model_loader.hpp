@@ -1,24 +1,571 @@
 #pragma once
 
-// #include "tinygltf/tiny_gltf.h"
+#include "tinygltf/tiny_gltf.h"
 #include "rapidobj/rapidobj.hpp"
+#include "glm/gtc/quaternion.hpp"
 #include "renderer/renderer.hpp" //TODO: Remove dependecy on renderer by creating Model.hpp or something
+#include "renderer/job_system.hpp"
+#include "mesh_optimizer.hpp"
+#include "scene_cache.hpp"
+#include "texture_manager.hpp"
 
 #include <string>
 #include <filesystem>
 #include <list>
+#include <numeric>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 
 namespace ModelLoader{
-    Renderer::Texture<Renderer::R8G8B8A8_U>* load_texture_to_scene(Renderer::Scene* scene, const std::filesystem::path& path){
-        Renderer::Image<Renderer::R8G8B8A8_U> image = Renderer::load_image(path);
-        scene->textures.push_back(Renderer::Texture<Renderer::R8G8B8A8_U>{});
-        auto& new_texture = scene->textures.back();
-        new_texture.mipmaps.push_back(image);
-        Renderer::generate_mipmaps(&new_texture);
-        return &new_texture;
+    // faces of a shape converted by one task
+    constexpr std::size_t FACES_PER_CHUNK = 1 << 16;
+    // vertices hashed by one task while looking for meshes that share positions
+    constexpr std::size_t VERTICES_PER_CHUNK = 1 << 16;
+
+    struct VertexChunk{
+        std::uint32_t mesh;
+        std::size_t first_vertex, last_vertex;
+    };
+
+    // group of every mesh, meshes with a vertex position in common end up in the same group. the
+    // positions go into an open addressing table of position hash and mesh, filled by all chunks at
+    // once, and a slot that already holds the position for another mesh links the two meshes. a
+    // hash collision only merges two groups that did not need to be. only vertices inside the
+    // bounds of another mesh can be shared, the others are not hashed.
+    std::vector<std::uint32_t> group_meshes_sharing_positions(const std::vector<std::vector<Renderer::Vertex>>& vertices,
+                                                              const std::vector<glm::vec3>& bounds_min, const std::vector<glm::vec3>& bounds_max){
+        constexpr std::uint32_t MESH_BITS = 20;
+        const std::uint32_t mesh_count = static_cast<std::uint32_t>(vertices.size());
+        std::vector<std::uint32_t> groups(mesh_count, 0);
+        // more meshes than the table can name all share one group
+        if (mesh_count >= (1u << MESH_BITS) - 1) return groups;
+        std::iota(groups.begin(), groups.end(), 0u);
+        if (mesh_count < 2) return groups;
+
+        // the part of every mesh's bounds that overlaps the bounds of other meshes, empty when none do
+        std::vector<glm::vec3> shared_min(mesh_count, glm::vec3(FLT_MAX)), shared_max(mesh_count, glm::vec3(-FLT_MAX));
+        for (std::uint32_t a = 0; a < mesh_count; a++){
+            for (std::uint32_t b = 0; b < mesh_count; b++){
+                if (a == b || vertices[a].empty() || vertices[b].empty()) continue;
+                const glm::vec3 overlap_min = glm::max(bounds_min[a], bounds_min[b]);
+                const glm::vec3 overlap_max = glm::min(bounds_max[a], bounds_max[b]);
+                if (glm::any(glm::greaterThan(overlap_min, overlap_max))) continue;
+                shared_min[a] = glm::min(shared_min[a], overlap_min);
+                shared_max[a] = glm::max(shared_max[a], overlap_max);
+            }
+        }
+
+        std::vector<VertexChunk> chunks;
+        std::size_t vertex_count = 0;
+        for (std::uint32_t mesh = 0; mesh < mesh_count; mesh++){
+            if (glm::any(glm::greaterThan(shared_min[mesh], shared_max[mesh]))) continue;
+            const std::size_t count = vertices[mesh].size();
+            for (std::size_t first = 0; first < count; first += VERTICES_PER_CHUNK)
+                chunks.push_back(VertexChunk{ .mesh = mesh, .first_vertex = first, .last_vertex = std::min(count, first + VERTICES_PER_CHUNK) });
+            vertex_count += count;
+        }
+
+        if (chunks.empty()) return groups;
+        const std::size_t table_mask = std::bit_ceil(2 * vertex_count) - 1;
+        std::vector<std::atomic<std::uint64_t>> table(table_mask + 1);
+        std::vector<std::vector<std::pair<std::uint32_t, std::uint32_t>>> links(chunks.size());
+        Renderer::parallel_for(static_cast<std::uint32_t>(chunks.size()), [&](std::uint32_t i){
+            const VertexChunk& chunk = chunks[i];
+            for (std::size_t v = chunk.first_vertex; v < chunk.last_vertex; v++){
+                // adding zero turns -0 into 0, they are the same position
+                const glm::vec3 position = glm::vec3(vertices[chunk.mesh][v].world_position) + 0.f;
+                if (glm::any(glm::lessThan(position, shared_min[chunk.mesh])) || glm::any(glm::greaterThan(position, shared_max[chunk.mesh]))) continue;
+                const std::uint64_t key = SceneCache::hash_bytes(1469598103934665603ull, &position, sizeof(position)) >> MESH_BITS;
+                const std::uint64_t entry = key << MESH_BITS | (chunk.mesh + 1);
+                for (std::size_t slot = key & table_mask;; slot = (slot + 1) & table_mask){
+                    std::uint64_t current = 0;
+                    if (table[slot].compare_exchange_strong(current, entry, std::memory_order_relaxed)) break;
+                    if (current >> MESH_BITS != key) continue;
+                    const std::uint32_t other = static_cast<std::uint32_t>(current & ((1u << MESH_BITS) - 1)) - 1;
+                    // neighbouring vertices mostly link the same two meshes
+                    if (other != chunk.mesh && (links[i].empty() || links[i].back().first != other))
+                        links[i].emplace_back(other, chunk.mesh);
+                    break;
+                }
+            }
+        });
+
+        auto find = [&](std::uint32_t mesh){
+            while (groups[mesh] != mesh) mesh = groups[mesh] = groups[groups[mesh]];
+            return mesh;
+        };
+        for (const auto& chunk_links : links)
+            for (const auto& [a, b] : chunk_links) groups[find(a)] = find(b);
+        for (std::uint32_t i = 0; i < mesh_count; i++) groups[i] = find(i);
+        return groups;
+    }
+
+    // packs vertices[i] into scene->meshes[i] and frees them. a mesh is quantized over its own
+    // bounds, unless it shares vertex positions with other meshes: those share the grid of the
+    // biggest of them, so the vertices on their common edges decode to the same positions.
+    void pack_meshes(Renderer::Scene* scene, std::vector<std::vector<Renderer::Vertex>>* vertices){
+        const std::uint32_t mesh_count = static_cast<std::uint32_t>(scene->meshes.size());
+        std::vector<float> cell_sizes(mesh_count, 0.f);
+        std::vector<glm::vec3> bounds_min(mesh_count, glm::vec3(0.f)), bounds_max(mesh_count, glm::vec3(0.f));
+        Renderer::parallel_for(mesh_count, [&](std::uint32_t i){
+            if ((*vertices)[i].empty()) return;
+            bounds_min[i] = bounds_max[i] = glm::vec3((*vertices)[i][0].world_position);
+            for (const Renderer::Vertex& vertex : (*vertices)[i]){
+                bounds_min[i] = glm::min(bounds_min[i], glm::vec3(vertex.world_position));
+                bounds_max[i] = glm::max(bounds_max[i], glm::vec3(vertex.world_position));
+            }
+            cell_sizes[i] = Renderer::get_position_cell_size(bounds_max[i] - bounds_min[i]);
+        });
+
+        const std::vector<std::uint32_t> groups = group_meshes_sharing_positions(*vertices, bounds_min, bounds_max);
+        std::vector<float> group_cell_sizes(mesh_count, 0.f);
+        for (std::uint32_t i = 0; i < mesh_count; i++) group_cell_sizes[groups[i]] = std::max(group_cell_sizes[groups[i]], cell_sizes[i]);
+
+        Renderer::parallel_for(mesh_count, [&](std::uint32_t i){
+            scene->meshes[i].vertices = Renderer::pack_vertices((*vertices)[i], group_cell_sizes[groups[i]], &scene->meshes[i].quantization);
+            (*vertices)[i] = {};
+        });
+    }
+
+    struct FaceChunk{
+        std::size_t shape;
+        std::size_t first_face, last_face;
+    };
+
+    // fills scene->meshes[i] with the triangulated faces of material i, faces without a material go
+    // to an extra mesh at the end, their vertices go to vertices[i] to be packed by pack_meshes.
+    // every face gets three vertices of its own. a counting pass sizes each mesh exactly and gives
+    // every chunk of faces its own range to write, so the chunks are converted in parallel without
+    // locks. the parser arrays are released once they are consumed.
+    void convert_meshes(rapidobj::Result* result, Renderer::Scene* scene, std::vector<std::vector<Renderer::Vertex>>* vertices){
+        const std::size_t material_count = result->materials.size();
+        const std::size_t slot_count = material_count + 1;
+        auto get_slot = [material_count](std::int32_t material_id){
+            return material_id < 0 ? material_count : static_cast<std::size_t>(material_id);
+        };
+
+        std::vector<FaceChunk> chunks;
+        std::vector<std::atomic<std::uint32_t>> chunks_left(result->shapes.size());
+        for (std::size_t shape = 0; shape < result->shapes.size(); shape++){
+            const std::size_t face_count = result->shapes[shape].mesh.num_face_vertices.size();
+            for (std::size_t first = 0; first < face_count; first += FACES_PER_CHUNK){
+                chunks.push_back(FaceChunk{ .shape = shape, .first_face = first, .last_face = std::min(face_count, first + FACES_PER_CHUNK) });
+                chunks_left[shape]++;
+            }
+        }
+        const std::uint32_t chunk_count = static_cast<std::uint32_t>(chunks.size());
+
+        // faces per chunk and material, then turned into the first face each chunk writes in its material's mesh
+        std::vector<std::size_t> face_offsets(chunk_count * slot_count, 0);
+        Renderer::parallel_for(chunk_count, [&](std::uint32_t i){
+            const rapidobj::Mesh& mesh = result->shapes[chunks[i].shape].mesh;
+            for (std::size_t face = chunks[i].first_face; face < chunks[i].last_face; face++)
+                face_offsets[i * slot_count + get_slot(mesh.material_ids[face])]++;
+        });
+        std::vector<std::size_t> face_counts(slot_count, 0);
+        for (std::size_t slot = 0; slot < slot_count; slot++){
+            for (std::uint32_t i = 0; i < chunk_count; i++){
+                const std::size_t count = face_offsets[i * slot_count + slot];
+                face_offsets[i * slot_count + slot] = face_counts[slot];
+                face_counts[slot] += count;
+            }
+        }
+
+        if (face_counts[material_count] > 0){
+            scene->meshes.push_back(Renderer::Mesh{
+                .material = Renderer::Material{
+                    .name = "default",
+                    .diffuse = glm::vec3(1.f),
+                    .transmittance = glm::vec3(1.f),
+                },
+            });
+        }
+        vertices->resize(scene->meshes.size());
+        Renderer::parallel_for(static_cast<std::uint32_t>(scene->meshes.size()), [&](std::uint32_t slot){
+            (*vertices)[slot].resize(3 * face_counts[slot]);
+            scene->meshes[slot].indices.resize(3 * face_counts[slot]);
+        });
+
+        Renderer::parallel_for(chunk_count, [&](std::uint32_t i){
+            const FaceChunk& chunk = chunks[i];
+            rapidobj::Mesh& mesh = result->shapes[chunk.shape].mesh;
+            const rapidobj::Array<float>& positions = result->attributes.positions;
+            const rapidobj::Array<float>& texcoords = result->attributes.texcoords;
+
+            std::vector<std::size_t> next_face(face_offsets.begin() + i * slot_count, face_offsets.begin() + (i + 1) * slot_count);
+            for (std::size_t face = chunk.first_face; face < chunk.last_face; face++){
+                const std::size_t slot = get_slot(mesh.material_ids[face]);
+                const std::size_t first_vertex = 3 * next_face[slot]++;
+                for (std::size_t k = 0; k < 3; k++){
+                    const rapidobj::Index& index = mesh.indices[face * 3 + k];
+                    (*vertices)[slot][first_vertex + k] = Renderer::Vertex{
+                        .texcoord0 = index.texcoord_index < 0 ? glm::vec2(0.f) : glm::vec2{
+                            texcoords[index.texcoord_index * 2 + 0],
+                            texcoords[index.texcoord_index * 2 + 1],
+                        },
+                        .world_position = glm::vec4{
+                            positions[index.position_index * 3 + 0],
+                            positions[index.position_index * 3 + 1],
+                            positions[index.position_index * 3 + 2],
+                            1.f
+                        },
+                    };
+                    scene->meshes[slot].indices[first_vertex + k] = static_cast<std::uint32_t>(first_vertex + k);
+                }
+            }
+
+            // the last chunk of a shape frees its faces
+            if (chunks_left[chunk.shape].fetch_sub(1) == 1) mesh = rapidobj::Mesh{};
+        });
+
+        result->attributes = rapidobj::Attributes{};
+        result->shapes = rapidobj::Shapes{};
+    }
+
+    // mtllib statements of an obj file, its scene cache depends on these files too
+    std::vector<std::filesystem::path> find_material_libraries(const std::filesystem::path& path){
+        std::vector<std::filesystem::path> libraries;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)){
+            if (line.rfind("mtllib", 0) != 0) continue;
+            std::istringstream names(line.substr(6));
+            std::string name;
+            while (names >> name) libraries.push_back(path.parent_path() / name);
+        }
+        return libraries;
+    }
+
+    // lower case, with the dot
+    std::string get_extension(const std::filesystem::path& path){
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
+        return extension;
+    }
+
+    // elements of a gltf accessor, read in place from the buffer they live in
+    struct AccessorView{
+        const std::uint8_t* data = nullptr;
+        std::size_t count = 0;
+        std::size_t byte_stride = 0;
+        int component_type = 0;
+    };
+
+    // component types core gltf allows for the attributes read here, the integer ones of
+    // KHR_mesh_quantization are not decoded
+    bool is_core_component_type(const tinygltf::Accessor& accessor, const std::string& attribute){
+        const int type = accessor.componentType;
+        if (attribute == "POSITION") return type == TINYGLTF_COMPONENT_TYPE_FLOAT;
+        if (attribute == "TEXCOORD_0")
+            return type == TINYGLTF_COMPONENT_TYPE_FLOAT
+                || (accessor.normalized && (type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE || type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT));
+        return !accessor.normalized && (type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE
+            || type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT || type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT);
+    }
+
+    // view of the accessor of attribute, or of the indices for any other name. fails for accessors
+    // of another type, sparse accessors, ranges outside of their buffer and component types that
+    // are not core gltf, which are reported.
+    bool get_accessor_view(const tinygltf::Model& model, int accessor_index, int type, const std::string& attribute, AccessorView* view){
+        if (accessor_index < 0 || static_cast<std::size_t>(accessor_index) >= model.accessors.size()) return false;
+        const tinygltf::Accessor& accessor = model.accessors[accessor_index];
+        if (accessor.type != type || accessor.sparse.isSparse) return false;
+        if (!is_core_component_type(accessor, attribute)){
+            std::cerr << "Unsupported glTF component type: " << attribute << " " << accessor.componentType
+                << (accessor.normalized ? " normalized" : "") << "\n";
+            return false;
+        }
+        if (accessor.bufferView < 0 || static_cast<std::size_t>(accessor.bufferView) >= model.bufferViews.size()) return false;
+        const tinygltf::BufferView& buffer_view = model.bufferViews[accessor.bufferView];
+        if (buffer_view.buffer < 0 || static_cast<std::size_t>(buffer_view.buffer) >= model.buffers.size()) return false;
+        const tinygltf::Buffer& buffer = model.buffers[buffer_view.buffer];
+
+        const int byte_stride = accessor.ByteStride(buffer_view);
+        const int element_size = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+        if (byte_stride <= 0 || element_size <= 0) return false;
+        const std::size_t offset = buffer_view.byteOffset + accessor.byteOffset;
+        if (accessor.count > 0 && offset + (accessor.count - 1) * byte_stride + element_size > buffer.data.size()) return false;
+
+        *view = AccessorView{
+            .data = buffer.data.data() + offset,
+            .count = accessor.count,
+            .byte_stride = static_cast<std::size_t>(byte_stride),
+            .component_type = accessor.componentType,
+        };
+        return true;
+    }
+
+    // component of an element as a float. get_accessor_view only lets normalized unsigned integers
+    // through, they are mapped to [0, 1]
+    float read_component(const AccessorView& view, std::size_t element, std::size_t component){
+        const std::uint8_t* data = view.data + element * view.byte_stride;
+        switch (view.component_type){
+        case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+            float value;
+            std::memcpy(&value, data + component * sizeof(float), sizeof(float));
+            return value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            std::uint16_t value;
+            std::memcpy(&value, data + component * sizeof(std::uint16_t), sizeof(std::uint16_t));
+            return value / 65535.f;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return data[component] / 255.f;
+        default:
+            return 0.f;
+        }
+    }
+
+    std::uint32_t read_index(const AccessorView& view, std::size_t element){
+        const std::uint8_t* data = view.data + element * view.byte_stride;
+        switch (view.component_type){
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+            std::uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+            std::uint16_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+        default:
+            return data[0];
+        }
+    }
+
+    // transform of a gltf node relative to its parent
+    glm::mat4 get_node_transform(const tinygltf::Node& node){
+        glm::mat4 transform(1.f);
+        if (node.matrix.size() == 16){
+            for (int i = 0; i < 16; i++) transform[i / 4][i % 4] = static_cast<float>(node.matrix[i]);
+            return transform;
+        }
+        if (node.translation.size() == 3)
+            transform = glm::translate(transform, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+        if (node.rotation.size() == 4)
+            transform *= glm::mat4_cast(glm::quat(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2])));
+        if (node.scale.size() == 3)
+            transform = glm::scale(transform, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+        return transform;
     }
 
-    void load_scene(Renderer::Scene* scene, std::filesystem::path const& path) {
+    // a triangle primitive drawn by a node, with the ranges it fills in the mesh of its material
+    struct PrimitiveInstance{
+        AccessorView positions, texcoords, indices;
+        glm::mat4 transform;
+        std::size_t slot;
+        std::size_t first_vertex, first_index;
+        std::size_t index_count;
+    };
+
+    // triangle primitives of every node of the default scene, or of every root node without one.
+    // unsupported primitives are skipped.
+    std::vector<PrimitiveInstance> collect_primitives(const tinygltf::Model& model){
+        std::vector<int> roots;
+        if (model.scenes.empty()){
+            std::vector<std::uint8_t> is_child(model.nodes.size(), 0);
+            for (const tinygltf::Node& node : model.nodes)
+                for (const int child : node.children)
+                    if (child >= 0 && static_cast<std::size_t>(child) < model.nodes.size()) is_child[child] = 1;
+            for (std::size_t i = 0; i < model.nodes.size(); i++)
+                if (!is_child[i]) roots.push_back(static_cast<int>(i));
+        } else {
+            roots = model.scenes[model.defaultScene >= 0 && static_cast<std::size_t>(model.defaultScene) < model.scenes.size() ? model.defaultScene : 0].nodes;
+        }
+
+        struct NodeItem{
+            int node;
+            glm::mat4 parent_transform;
+            std::size_t depth;
+        };
+        std::vector<NodeItem> stack;
+        for (const int root : roots) stack.push_back(NodeItem{ .node = root, .parent_transform = glm::mat4(1.f), .depth = 0 });
+
+        const std::size_t default_slot = model.materials.size();
+        std::vector<PrimitiveInstance> instances;
+        while (!stack.empty()){
+            const NodeItem item = stack.back();
+            stack.pop_back();
+            // a deeper path than there are nodes can only come from a cycle
+            if (item.node < 0 || static_cast<std::size_t>(item.node) >= model.nodes.size() || item.depth > model.nodes.size()) continue;
+            const tinygltf::Node& node = model.nodes[item.node];
+            const glm::mat4 transform = item.parent_transform * get_node_transform(node);
+            for (const int child : node.children) stack.push_back(NodeItem{ .node = child, .parent_transform = transform, .depth = item.depth + 1 });
+
+            if (node.mesh < 0 || static_cast<std::size_t>(node.mesh) >= model.meshes.size()) continue;
+            for (const tinygltf::Primitive& primitive : model.meshes[node.mesh].primitives){
+                if (primitive.mode != -1 && primitive.mode != TINYGLTF_MODE_TRIANGLES) continue;
+                PrimitiveInstance instance{ .transform = transform };
+                const auto position = primitive.attributes.find("POSITION");
+                if (position == primitive.attributes.end() || !get_accessor_view(model, position->second, TINYGLTF_TYPE_VEC3, position->first, &instance.positions)) continue;
+                if (instance.positions.count == 0) continue;
+                const auto texcoord = primitive.attributes.find("TEXCOORD_0");
+                if (texcoord != primitive.attributes.end() && !get_accessor_view(model, texcoord->second, TINYGLTF_TYPE_VEC2, texcoord->first, &instance.texcoords)) continue;
+                if (instance.texcoords.data && instance.texcoords.count < instance.positions.count) continue;
+                if (primitive.indices >= 0 && !get_accessor_view(model, primitive.indices, TINYGLTF_TYPE_SCALAR, "indices", &instance.indices)) continue;
+
+                instance.index_count = (instance.indices.data ? instance.indices.count : instance.positions.count) / 3 * 3;
+                instance.slot = primitive.material >= 0 && static_cast<std::size_t>(primitive.material) < model.materials.size() ? primitive.material : default_slot;
+                instances.push_back(instance);
+            }
+        }
+        return instances;
+    }
+
+    // fills scene->meshes with one mesh per gltf material that is drawn, primitives without a
+    // material go to an extra mesh. node transforms are applied to the positions. vertices and
+    // indices are read straight from the buffers, every vertex of a primitive is converted once
+    // per node drawing it and keeps the indexing of the file. the vertices are packed at the end.
+    void convert_gltf_meshes(const tinygltf::Model& model, const std::filesystem::path& path, Renderer::Scene* scene, TextureManager::TextureCache* texture_cache){
+        std::vector<PrimitiveInstance> instances = collect_primitives(model);
+
+        const std::size_t slot_count = model.materials.size() + 1;
+        std::vector<std::size_t> vertex_counts(slot_count, 0), index_counts(slot_count, 0);
+        for (PrimitiveInstance& instance : instances){
+            instance.first_vertex = vertex_counts[instance.slot];
+            instance.first_index = index_counts[instance.slot];
+            vertex_counts[instance.slot] += instance.positions.count;
+            index_counts[instance.slot] += instance.index_count;
+        }
+
+        // the texture cache keeps pointers to the materials, the meshes must not move after this
+        std::vector<std::size_t> slot_meshes(slot_count, 0);
+        std::size_t mesh_count = 0;
+        for (std::size_t slot = 0; slot < slot_count; slot++)
+            if (index_counts[slot] > 0) slot_meshes[slot] = mesh_count++;
+        scene->meshes.resize(mesh_count);
+
+        for (std::size_t slot = 0; slot < slot_count; slot++){
+            if (index_counts[slot] == 0) continue;
+            Renderer::Mesh& mesh = scene->meshes[slot_meshes[slot]];
+            if (slot == model.materials.size()){
+                mesh.material = Renderer::Material{
+                    .name = "default",
+                    .diffuse = glm::vec3(1.f),
+                    .transmittance = glm::vec3(1.f),
+                };
+                continue;
+            }
+
+            const tinygltf::Material& gltf_mat = model.materials[slot];
+            const std::vector<double>& base_color = gltf_mat.pbrMetallicRoughness.baseColorFactor;
+            const std::vector<double>& emission = gltf_mat.emissiveFactor;
+            const float alpha = base_color.size() == 4 ? static_cast<float>(base_color[3]) : 1.f;
+            mesh.material = Renderer::Material{
+                .name = gltf_mat.name,
+                .ambient = glm::vec3(0.f),
+                .diffuse = base_color.size() >= 3 ? glm::vec3(base_color[0], base_color[1], base_color[2]) : glm::vec3(1.f),
+                .specular = glm::vec3(0.f),
+                // blended materials count as transparent like obj materials with a transmittance below one
+                .transmittance = glm::vec3(gltf_mat.alphaMode == "BLEND" ? alpha : 1.f),
+                .emission = emission.size() == 3 ? glm::vec3(emission[0], emission[1], emission[2]) : glm::vec3(0.f),
+                .diffuse_tex = nullptr,
+                .specular_tex = nullptr,
+            };
+
+            const int texture_index = gltf_mat.pbrMetallicRoughness.baseColorTexture.index;
+            if (texture_index < 0 || static_cast<std::size_t>(texture_index) >= model.textures.size()) continue;
+            const int image_index = model.textures[texture_index].source;
+            if (image_index < 0 || static_cast<std::size_t>(image_index) >= model.images.size()) continue;
+
+            // external images are named by their path so they are shared with other files, embedded ones by their index
+            const tinygltf::Image& image = model.images[image_index];
+            std::string key = path.generic_string() + "#image" + std::to_string(image_index);
+            if (!image.uri.empty() && image.uri.rfind("data:", 0) != 0){
+                std::error_code error;
+                const std::filesystem::path image_path = std::filesystem::weakly_canonical(path.parent_path() / image.uri, error);
+                if (!error) key = image_path.generic_string();
+            }
+            TextureManager::request_encoded_texture(texture_cache, key, image.image, &mesh.material.diffuse_tex, Renderer::to_r8g8b8a8_u(glm::vec4(mesh.material.diffuse, 1.f)));
+        }
+
+        std::vector<std::vector<Renderer::Vertex>> mesh_vertices(mesh_count);
+        Renderer::parallel_for(static_cast<std::uint32_t>(slot_count), [&](std::uint32_t slot){
+            if (index_counts[slot] == 0) return;
+            mesh_vertices[slot_meshes[slot]].resize(vertex_counts[slot]);
+            scene->meshes[slot_meshes[slot]].indices.resize(index_counts[slot]);
+        });
+
+        Renderer::parallel_for(static_cast<std::uint32_t>(instances.size()), [&](std::uint32_t i){
+            const PrimitiveInstance& instance = instances[i];
+            Renderer::Mesh& mesh = scene->meshes[slot_meshes[instance.slot]];
+
+            Renderer::Vertex* vertices = mesh_vertices[slot_meshes[instance.slot]].data() + instance.first_vertex;
+            for (std::size_t v = 0; v < instance.positions.count; v++){
+                const glm::vec3 position(
+                    read_component(instance.positions, v, 0),
+                    read_component(instance.positions, v, 1),
+                    read_component(instance.positions, v, 2));
+                vertices[v] = Renderer::Vertex{
+                    .texcoord0 = instance.texcoords.data
+                        ? glm::vec2(read_component(instance.texcoords, v, 0), read_component(instance.texcoords, v, 1))
+                        : glm::vec2(0.f),
+                    .world_position = instance.transform * glm::vec4(position, 1.f),
+                };
+            }
+
+            // a mirroring transform turns the triangles around, out of range indices point at the first vertex
+            const bool is_mirrored = glm::determinant(glm::mat3(instance.transform)) < 0.f;
+            const std::uint32_t vertex_count = static_cast<std::uint32_t>(instance.positions.count);
+            const std::uint32_t first_vertex = static_cast<std::uint32_t>(instance.first_vertex);
+            std::uint32_t* indices = mesh.indices.data() + instance.first_index;
+            for (std::size_t k = 0; k < instance.index_count; k++){
+                const std::uint32_t index = instance.indices.data ? read_index(instance.indices, k) : static_cast<std::uint32_t>(k);
+                indices[k] = first_vertex + (index < vertex_count ? index : 0);
+            }
+            if (is_mirrored)
+                for (std::size_t k = 0; k < instance.index_count; k += 3) std::swap(indices[k + 1], indices[k + 2]);
+        });
+
+        pack_meshes(scene, &mesh_vertices);
+    }
+
+    // loads a .gltf file with its buffers and images or a .glb file. images stay encoded and are
+    // streamed in through texture_cache.
+    void load_gltf_scene(Renderer::Scene* scene, TextureManager::TextureCache* texture_cache, std::filesystem::path const& path){
+        tinygltf::TinyGLTF loader;
+        loader.SetImagesAsIs(true);
+        tinygltf::Model model;
+        std::string error, warning;
+
+        const bool success = get_extension(path) == ".glb"
+            ? loader.LoadBinaryFromFile(&model, &error, &warning, path.string())
+            : loader.LoadASCIIFromFile(&model, &error, &warning, path.string());
+        if (!warning.empty()) std::cerr << "Warning loading glTF file: " << warning << "\n";
+        if (!success){
+            std::cerr << "Error loading glTF file: " << path << " " << error << "\n";
+            return;
+        }
+
+        scene->meshes.clear();
+        scene->meshes.shrink_to_fit();
+        convert_gltf_meshes(model, path, scene, texture_cache);
+    }
+
+    // loads .gltf and .glb files with load_gltf_scene. for obj files, loads the scene cache of path
+    // when it is still up to date, otherwise parses the obj file and writes the cache for the next
+    // launch. textures of a parsed file are streamed in through texture_cache, load_scene returns
+    // before they are decoded and the cache is written after.
+    void load_scene(Renderer::Scene* scene, TextureManager::TextureCache* texture_cache, std::filesystem::path const& path) {
+        const std::string extension = get_extension(path);
+        if (extension == ".gltf" || extension == ".glb"){
+            load_gltf_scene(scene, texture_cache, path);
+            return;
+        }
+
+        const std::filesystem::path cache_path = SceneCache::get_cache_path(path);
+        if (SceneCache::load_scene_cache(scene, cache_path)){
+            std::cout << "load scene cache:" << cache_path << std::endl;
+            return;
+        }
+
         scene->meshes.clear();
         scene->meshes.shrink_to_fit();
 
@@ -34,6 +581,16 @@ namespace ModelLoader{
             return;
         }
 
+        // only positions and texcoords are converted
+        result.attributes.normals = {};
+        result.attributes.colors = {};
+
+        std::vector<std::filesystem::path> sources = {path};
+        for (const std::filesystem::path& library : find_material_libraries(path)) sources.push_back(library);
+
+        Renderer::TaskGraph load_tasks;
+        // the texture cache keeps pointers to the materials, the default mesh must not move them
+        scene->meshes.reserve(result.materials.size() + 1);
         scene->meshes.resize(result.materials.size());
         for (std::size_t i = 0; i < result.materials.size(); i++){
             Renderer::Mesh& mesh = scene->meshes[i];
@@ -54,69 +611,29 @@ namespace ModelLoader{
             };
             if (obj_mat.diffuse_texname != ""){
                 const std::filesystem::path tex_path = path.parent_path() / obj_mat.diffuse_texname;
-                Renderer::Texture<Renderer::R8G8B8A8_U>* tex = load_texture_to_scene(scene, tex_path);
-                mesh.material.diffuse_tex = tex;
+                sources.push_back(tex_path);
+                // the material's own color until the texture is decoded
+                TextureManager::request_texture(texture_cache, tex_path, &mesh.material.diffuse_tex, Renderer::to_r8g8b8a8_u(glm::vec4(mesh.material.diffuse, 1.f)));
             }
         }
 
-        for (const rapidobj::Shape& shape : result.shapes) {
-            const rapidobj::Mesh& mesh = shape.mesh;
-
-            const size_t num_faces = mesh.num_face_vertices.size();
-            for (size_t face_idx = 0; face_idx < num_faces; face_idx++){
-                const size_t mat_id = mesh.material_ids[face_idx];
-                
-                const std::uint32_t num_face_vertices = static_cast<std::uint32_t>(scene->meshes[mat_id].indices.size());
-                scene->meshes[mat_id].indices.push_back(num_face_vertices + 0);
-                scene->meshes[mat_id].indices.push_back(num_face_vertices + 1);
-                scene->meshes[mat_id].indices.push_back(num_face_vertices + 2);
-
-                scene->meshes[mat_id].vertices.push_back(
-                    Renderer::Vertex{
-                        .texcoord0 = 
-                            glm::vec2{
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 0].texcoord_index * 2 + 0],
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 0].texcoord_index * 2 + 1]
-                            },   
-                        .world_position = glm::vec4{
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 0].position_index * 3 + 0],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 0].position_index * 3 + 1],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 0].position_index * 3 + 2],
-                            1.f
-                        }, 
-                    }
-                );
-                scene->meshes[mat_id].vertices.push_back(
-                    Renderer::Vertex{
-                        .texcoord0 = 
-                            glm::vec2{
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 1].texcoord_index * 2 + 0],
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 1].texcoord_index * 2 + 1]
-                            },   
-                        .world_position = glm::vec4{
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 1].position_index * 3 + 0],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 1].position_index * 3 + 1],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 1].position_index * 3 + 2],
-                            1.f
-                        }, 
-                    }
-                );
-                scene->meshes[mat_id].vertices.push_back(
-                    Renderer::Vertex{
-                        .texcoord0 = 
-                            glm::vec2{
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 2].texcoord_index * 2 + 0],
-                                result.attributes.texcoords[mesh.indices[face_idx * 3 + 2].texcoord_index * 2 + 1]
-                            },   
-                        .world_position = glm::vec4{
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 2].position_index * 3 + 0],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 2].position_index * 3 + 1],
-                            result.attributes.positions[mesh.indices[face_idx * 3 + 2].position_index * 3 + 2],
-                            1.f
-                        }, 
-                    }
-                );
-            }
-        }
+        // the geometry is converted on workers too, while idle workers decode the textures
+        std::vector<std::vector<Renderer::Vertex>> mesh_vertices;
+        const std::uint32_t convert = Renderer::add_task(&load_tasks, [&]{ convert_meshes(&result, scene, &mesh_vertices); });
+
+        // every face got three vertices of its own, pack and weld them and reorder the triangles for the vertex cache
+        Renderer::add_task(&load_tasks, [scene, &mesh_vertices]{
+            pack_meshes(scene, &mesh_vertices);
+            Renderer::parallel_for(static_cast<std::uint32_t>(scene->meshes.size()), [scene](std::uint32_t i){
+                MeshOptimizer::optimize_mesh(&scene->meshes[i]);
+            });
+        }, {convert});
+
+        Renderer::run_task_graph(load_tasks);
+
+        TextureManager::run_when_streamed(texture_cache, [scene, cache_path, sources]{
+            if (!SceneCache::write_scene_cache(*scene, cache_path, sources))
+                std::cerr << "Error writing scene cache: " << cache_path << "\n";
+        });
     }
-}
\ No newline at end of file
+}
@@ -12,40 +12,40 @@ namespace Primitives {
         return {
             .vertex = {
                 // -X face
-                {{-1.f, -1.f, -1.f, 1.0f},{0.f, 0.f}},
-                {{-1.f,  1.f, -1.f, 1.0f},{1.f, 0.f}},
-                {{-1.f, -1.f,  1.f, 1.0f},{0.f, 1.f}},
-                {{-1.f,  1.f,  1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{-1.f, -1.f, -1.f, 1.0f}},
+                {{1.f, 0.f},{-1.f,  1.f, -1.f, 1.0f}},
+                {{0.f, 1.f},{-1.f, -1.f,  1.f, 1.0f}},
+                {{1.f, 1.f},{-1.f,  1.f,  1.f, 1.0f}},
     
                 // +X face
-                {{ 1.f, -1.f, -1.f, 1.0f},{0.f, 0.f}},
-                {{ 1.f,  1.f, -1.f, 1.0f},{1.f, 0.f}},
-                {{ 1.f, -1.f,  1.f, 1.0f},{0.f, 1.f}},
-                {{ 1.f,  1.f,  1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{ 1.f, -1.f, -1.f, 1.0f}},
+                {{1.f, 0.f},{ 1.f,  1.f, -1.f, 1.0f}},
+                {{0.f, 1.f},{ 1.f, -1.f,  1.f, 1.0f}},
+                {{1.f, 1.f},{ 1.f,  1.f,  1.f, 1.0f}},
     
                 // -Y face
-                {{-1.f, -1.f, -1.f, 1.0f},{0.f, 0.f}},
-                {{ 1.f, -1.f, -1.f, 1.0f},{1.f, 0.f}},
-                {{-1.f, -1.f,  1.f, 1.0f},{0.f, 1.f}},
-                {{ 1.f, -1.f,  1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{-1.f, -1.f, -1.f, 1.0f}},
+                {{1.f, 0.f},{ 1.f, -1.f, -1.f, 1.0f}},
+                {{0.f, 1.f},{-1.f, -1.f,  1.f, 1.0f}},
+                {{1.f, 1.f},{ 1.f, -1.f,  1.f, 1.0f}},
     
                 // +Y face
-                {{-1.f,  1.f, -1.f, 1.0f},{0.f, 0.f}},
-                {{ 1.f,  1.f, -1.f, 1.0f},{1.f, 0.f}},
-                {{-1.f,  1.f,  1.f, 1.0f},{0.f, 1.f}},
-                {{ 1.f,  1.f,  1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{-1.f,  1.f, -1.f, 1.0f}},
+                {{1.f, 0.f},{ 1.f,  1.f, -1.f, 1.0f}},
+                {{0.f, 1.f},{-1.f,  1.f,  1.f, 1.0f}},
+                {{1.f, 1.f},{ 1.f,  1.f,  1.f, 1.0f}},
     
                 // -Z face
-                {{-1.f, -1.f, -1.f, 1.0f},{0.f, 0.f}},
-                {{ 1.f, -1.f, -1.f, 1.0f},{1.f, 0.f}},
-                {{-1.f,  1.f, -1.f, 1.0f},{0.f, 1.f}},
-                {{ 1.f,  1.f, -1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{-1.f, -1.f, -1.f, 1.0f}},
+                {{1.f, 0.f},{ 1.f, -1.f, -1.f, 1.0f}},
+                {{0.f, 1.f},{-1.f,  1.f, -1.f, 1.0f}},
+                {{1.f, 1.f},{ 1.f,  1.f, -1.f, 1.0f}},
     
                 // +Z face
-                {{-1.f, -1.f,  1.f, 1.0f},{0.f, 0.f}},
-                {{ 1.f, -1.f,  1.f, 1.0f},{1.f, 0.f}},
-                {{-1.f,  1.f,  1.f, 1.0f},{0.f, 1.f}},
-                {{ 1.f,  1.f,  1.f, 1.0f},{1.f, 1.f}},
+                {{0.f, 0.f},{-1.f, -1.f,  1.f, 1.0f}},
+                {{1.f, 0.f},{ 1.f, -1.f,  1.f, 1.0f}},
+                {{0.f, 1.f},{-1.f,  1.f,  1.f, 1.0f}},
+                {{1.f, 1.f},{ 1.f,  1.f,  1.f, 1.0f}},
             },
             .index = {
                 // -X face
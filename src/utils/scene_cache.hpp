@@ -0,0 +1,376 @@
+#pragma once
+
+#include "renderer/renderer.hpp"
+#include "renderer/job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <filesystem>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#undef near
+#undef far
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// binary copy of a loaded scene. textures are stored with their whole mip chain and meshes after
+// welding and reordering, every array as the raw bytes of its elements aligned to ARRAY_ALIGNMENT,
+// so loading is one memcpy per array out of the mapped file. the scene keeps its arrays in vectors,
+// so they are copied out instead of being used in place, which costs about a copy of the file on
+// top of paging it in. the file lists the source files the scene was built from and is only used
+// while their sizes and write times still hash to the same value.
+namespace SceneCache{
+    constexpr std::array<char, 8> MAGIC = {'T', 'W', 'S', 'C', 'E', 'N', 'E', '\0'};
+    // bump whenever the layout below or PackedVertex changes
+    constexpr std::uint32_t VERSION = 2;
+    constexpr std::size_t ARRAY_ALIGNMENT = 16;
+
+    static_assert(std::is_trivially_copyable_v<Renderer::PackedVertex>);
+    static_assert(std::is_trivially_copyable_v<Renderer::VertexQuantization>);
+    static_assert(std::is_trivially_copyable_v<Renderer::R8G8B8A8_U>);
+
+    struct FileHeader{
+        std::array<char, 8> magic;
+        std::uint32_t version;
+        std::uint32_t dependency_count;
+        std::uint64_t source_hash;
+        std::uint32_t texture_count;
+        std::uint32_t mesh_count;
+    };
+
+    struct MappedFile{
+        const std::uint8_t* data = nullptr;
+        std::size_t size = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int file = -1;
+#endif
+    };
+
+    inline void unmap_file(MappedFile* mapped){
+#ifdef _WIN32
+        if (mapped->data) UnmapViewOfFile(mapped->data);
+        if (mapped->mapping) CloseHandle(mapped->mapping);
+        if (mapped->file != INVALID_HANDLE_VALUE) CloseHandle(mapped->file);
+#else
+        if (mapped->data) munmap(const_cast<std::uint8_t*>(mapped->data), mapped->size);
+        if (mapped->file >= 0) close(mapped->file);
+#endif
+        *mapped = MappedFile{};
+    }
+
+    inline bool map_file(const std::filesystem::path& path, MappedFile* mapped){
+#ifdef _WIN32
+        mapped->file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mapped->file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(mapped->file, &size) || size.QuadPart == 0){
+            unmap_file(mapped);
+            return false;
+        }
+        mapped->size = static_cast<std::size_t>(size.QuadPart);
+        mapped->mapping = CreateFileMappingW(mapped->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapped->mapping) mapped->data = static_cast<const std::uint8_t*>(MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        mapped->file = open(path.c_str(), O_RDONLY);
+        if (mapped->file < 0) return false;
+        struct stat info;
+        if (fstat(mapped->file, &info) != 0 || info.st_size == 0){
+            unmap_file(mapped);
+            return false;
+        }
+        mapped->size = static_cast<std::size_t>(info.st_size);
+        void* data = mmap(nullptr, mapped->size, PROT_READ, MAP_PRIVATE, mapped->file, 0);
+        if (data != MAP_FAILED){
+            mapped->data = static_cast<const std::uint8_t*>(data);
+            madvise(data, mapped->size, MADV_WILLNEED);
+        }
+#endif
+        if (!mapped->data){
+            unmap_file(mapped);
+            return false;
+        }
+        return true;
+    }
+
+    inline std::uint64_t hash_bytes(std::uint64_t hash, const void* data, std::size_t size){
+        const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+        for (std::size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    // hash of the paths, sizes and write times of the source files. a missing file is hashed as
+    // such, so the cache stays valid while it is missing and the other files are unchanged and
+    // goes stale when any of them changes or the file shows up.
+    inline std::uint64_t hash_source_files(const std::vector<std::filesystem::path>& paths){
+        constexpr std::uint64_t MISSING_SIZE = UINT64_MAX;
+        std::uint64_t hash = 1469598103934665603ull;
+        for (const std::filesystem::path& path : paths){
+            std::error_code error;
+            std::uint64_t size = std::filesystem::file_size(path, error);
+            std::int64_t write_time = 0;
+            if (!error) write_time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+            if (error){
+                size = MISSING_SIZE;
+                write_time = 0;
+            }
+            const std::string name = path.generic_string();
+            hash = hash_bytes(hash, name.data(), name.size());
+            hash = hash_bytes(hash, &size, sizeof(size));
+            hash = hash_bytes(hash, &write_time, sizeof(write_time));
+        }
+        return hash;
+    }
+
+    // cache file of a source scene, named by a hash of its path
+    inline std::filesystem::path get_cache_path(const std::filesystem::path& source_path){
+        const std::string name = std::filesystem::absolute(source_path).lexically_normal().generic_string();
+        char file_name[32];
+        std::snprintf(file_name, sizeof(file_name), "%016llx.scene", static_cast<unsigned long long>(hash_bytes(1469598103934665603ull, name.data(), name.size())));
+        return std::filesystem::path("./bin/cache") / file_name;
+    }
+
+    struct Writer{
+        std::ofstream out;
+        std::size_t offset = 0;
+
+        template<typename T>
+        void write(const T& value){
+            static_assert(std::is_trivially_copyable_v<T>);
+            write_bytes(&value, sizeof(T));
+        }
+
+        void write_bytes(const void* data, std::size_t size){
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+            offset += size;
+        }
+
+        void write_string(const std::string& value){
+            write(static_cast<std::uint32_t>(value.size()));
+            write_bytes(value.data(), value.size());
+        }
+
+        // element count, padding up to ARRAY_ALIGNMENT, then the elements
+        template<typename T>
+        void write_array(const std::vector<T>& values){
+            static_assert(std::is_trivially_copyable_v<T>);
+            write(static_cast<std::uint64_t>(values.size()));
+            static constexpr std::array<char, ARRAY_ALIGNMENT> padding{};
+            write_bytes(padding.data(), (ARRAY_ALIGNMENT - offset % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT);
+            write_bytes(values.data(), values.size() * sizeof(T));
+        }
+    };
+
+    // reads the mapped file front to back, every read is bounds checked and a failed one makes
+    // all later reads fail too
+    struct Reader{
+        const std::uint8_t* data;
+        std::size_t size;
+        std::size_t offset = 0;
+        bool is_valid = true;
+
+        const std::uint8_t* read_bytes(std::size_t count){
+            if (!is_valid || count > size - offset){
+                is_valid = false;
+                return nullptr;
+            }
+            const std::uint8_t* bytes = data + offset;
+            offset += count;
+            return bytes;
+        }
+
+        template<typename T>
+        T read(){
+            T value{};
+            if (const std::uint8_t* bytes = read_bytes(sizeof(T))) std::memcpy(&value, bytes, sizeof(T));
+            return value;
+        }
+
+        std::string read_string(){
+            const std::uint32_t length = read<std::uint32_t>();
+            const std::uint8_t* bytes = read_bytes(length);
+            return bytes ? std::string(reinterpret_cast<const char*>(bytes), length) : std::string();
+        }
+
+        // returns the elements in place, they are copied out later
+        template<typename T>
+        const T* read_array(std::uint64_t* count){
+            *count = read<std::uint64_t>();
+            read_bytes((ARRAY_ALIGNMENT - offset % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT);
+            if (*count > size / sizeof(T)) is_valid = false;
+            return reinterpret_cast<const T*>(read_bytes(*count * sizeof(T)));
+        }
+    };
+
+    // writes scene to cache_path, sources are the files it was loaded from. the file is written
+    // next to cache_path first and renamed, so a cache is never seen half written.
+    inline bool write_scene_cache(const Renderer::Scene& scene, const std::filesystem::path& cache_path, const std::vector<std::filesystem::path>& sources){
+        std::error_code error;
+        std::filesystem::create_directories(cache_path.parent_path(), error);
+        const std::filesystem::path temp_path = std::filesystem::path(cache_path).concat(".tmp");
+
+        Writer writer{ .out = std::ofstream(temp_path, std::ios::binary) };
+        if (!writer.out) return false;
+
+        std::vector<const Renderer::Texture<Renderer::R8G8B8A8_U>*> textures;
+        for (const auto& texture : scene.textures) textures.push_back(&texture);
+        auto get_texture_index = [&](const Renderer::Texture<Renderer::R8G8B8A8_U>* texture){
+            const auto it = std::find(textures.begin(), textures.end(), texture);
+            return it == textures.end() ? -1 : static_cast<std::int32_t>(it - textures.begin());
+        };
+
+        writer.write(FileHeader{
+            .magic = MAGIC,
+            .version = VERSION,
+            .dependency_count = static_cast<std::uint32_t>(sources.size()),
+            .source_hash = hash_source_files(sources),
+            .texture_count = static_cast<std::uint32_t>(textures.size()),
+            .mesh_count = static_cast<std::uint32_t>(scene.meshes.size()),
+        });
+        for (const std::filesystem::path& source : sources) writer.write_string(source.generic_string());
+
+        for (const auto* texture : textures){
+            writer.write(static_cast<std::uint32_t>(texture->mipmaps.size()));
+            for (const auto& mip : texture->mipmaps){
+                writer.write(mip.width);
+                writer.write(mip.height);
+                writer.write_array(mip.image);
+            }
+        }
+
+        for (const Renderer::Mesh& mesh : scene.meshes){
+            const Renderer::Material& material = mesh.material;
+            writer.write_string(material.name);
+            writer.write(material.ambient);
+            writer.write(material.diffuse);
+            writer.write(material.specular);
+            writer.write(material.transmittance);
+            writer.write(material.emission);
+            writer.write(get_texture_index(material.diffuse_tex));
+            writer.write(get_texture_index(material.specular_tex));
+            writer.write(mesh.quantization);
+            writer.write_array(mesh.vertices);
+            writer.write_array(mesh.indices);
+        }
+
+        writer.out.close();
+        if (!writer.out){
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+        std::filesystem::rename(temp_path, cache_path, error);
+        return !error;
+    }
+
+    // replaces scene with the cached one, returns false and leaves scene alone when the cache is
+    // missing, of another version, broken or older than its sources. indices pointing past the
+    // vertices of their mesh count as broken, draws index the vertices without checks.
+    inline bool load_scene_cache(Renderer::Scene* scene, const std::filesystem::path& cache_path){
+        MappedFile mapped;
+        if (!map_file(cache_path, &mapped)) return false;
+
+        Reader reader{ .data = mapped.data, .size = mapped.size };
+        const FileHeader header = reader.read<FileHeader>();
+        if (!reader.is_valid || header.magic != MAGIC || header.version != VERSION){
+            unmap_file(&mapped);
+            return false;
+        }
+
+        std::vector<std::filesystem::path> sources;
+        for (std::uint32_t i = 0; i < header.dependency_count && reader.is_valid; i++) sources.push_back(reader.read_string());
+        if (!reader.is_valid || hash_source_files(sources) != header.source_hash){
+            unmap_file(&mapped);
+            return false;
+        }
+
+        // walk the file once to size everything, the arrays are copied afterwards in parallel
+        Renderer::Scene loaded;
+        std::vector<std::function<void()>> copies;
+        std::atomic<bool> is_intact{true};
+        std::vector<Renderer::Texture<Renderer::R8G8B8A8_U>*> textures;
+        for (std::uint32_t i = 0; i < header.texture_count && reader.is_valid; i++){
+            auto& texture = loaded.textures.emplace_back();
+            textures.push_back(&texture);
+            const std::uint32_t mip_count = reader.read<std::uint32_t>();
+            if (mip_count > 32) reader.is_valid = false;
+            texture.mipmaps.resize(reader.is_valid ? mip_count : 0);
+            for (auto& mip : texture.mipmaps){
+                mip.width = reader.read<std::uint32_t>();
+                mip.height = reader.read<std::uint32_t>();
+                std::uint64_t count = 0;
+                const Renderer::R8G8B8A8_U* texels = reader.read_array<Renderer::R8G8B8A8_U>(&count);
+                if (count != static_cast<std::uint64_t>(mip.width) * mip.height) reader.is_valid = false;
+                copies.push_back([&mip, texels, count]{ mip.image.assign(texels, texels + count); });
+            }
+        }
+
+        // every mesh takes more than a byte, so a bigger count can only come from a broken file
+        if (header.mesh_count > mapped.size) reader.is_valid = false;
+        loaded.meshes.resize(reader.is_valid ? header.mesh_count : 0);
+        auto get_texture = [&](std::int32_t index){
+            if (index < 0) return static_cast<Renderer::Texture<Renderer::R8G8B8A8_U>*>(nullptr);
+            if (static_cast<std::size_t>(index) >= textures.size()){
+                reader.is_valid = false;
+                return static_cast<Renderer::Texture<Renderer::R8G8B8A8_U>*>(nullptr);
+            }
+            return textures[index];
+        };
+        for (Renderer::Mesh& mesh : loaded.meshes){
+            mesh.material.name = reader.read_string();
+            mesh.material.ambient = reader.read<glm::vec3>();
+            mesh.material.diffuse = reader.read<glm::vec3>();
+            mesh.material.specular = reader.read<glm::vec3>();
+            mesh.material.transmittance = reader.read<glm::vec3>();
+            mesh.material.emission = reader.read<glm::vec3>();
+            mesh.material.diffuse_tex = get_texture(reader.read<std::int32_t>());
+            mesh.material.specular_tex = get_texture(reader.read<std::int32_t>());
+
+            mesh.quantization = reader.read<Renderer::VertexQuantization>();
+            const Renderer::VertexQuantization& q = mesh.quantization;
+            const std::array<float, 8> decode_values = { q.position_origin.x, q.position_origin.y, q.position_origin.z, q.position_cell_size,
+                                                         q.texcoord_min.x, q.texcoord_min.y, q.texcoord_step.x, q.texcoord_step.y };
+            if (!(q.position_cell_size > 0.f) || !std::all_of(decode_values.begin(), decode_values.end(), [](float v){ return std::isfinite(v); }))
+                reader.is_valid = false;
+
+            std::uint64_t vertex_count = 0, index_count = 0;
+            const Renderer::PackedVertex* vertices = reader.read_array<Renderer::PackedVertex>(&vertex_count);
+            const std::uint32_t* indices = reader.read_array<std::uint32_t>(&index_count);
+            copies.push_back([&mesh, vertices, vertex_count]{ mesh.vertices.assign(vertices, vertices + vertex_count); });
+            copies.push_back([&mesh, &is_intact, indices, index_count, vertex_count]{
+                mesh.indices.assign(indices, indices + index_count);
+                if (std::any_of(mesh.indices.begin(), mesh.indices.end(), [vertex_count](std::uint32_t index){ return index >= vertex_count; }))
+                    is_intact.store(false, std::memory_order_relaxed);
+            });
+        }
+
+        if (!reader.is_valid){
+            unmap_file(&mapped);
+            return false;
+        }
+        Renderer::parallel_for(static_cast<std::uint32_t>(copies.size()), [&](std::uint32_t i){ copies[i](); });
+        unmap_file(&mapped);
+        if (!is_intact.load()) return false;
+
+        *scene = std::move(loaded);
+        return true;
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "renderer/renderer.hpp"
+#include "renderer/job_system.hpp"
+#include "scene_cache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace TextureManager{
+    using Texture = Renderer::Texture<Renderer::R8G8B8A8_U>;
+
+    // a file handed to request_texture
+    struct StreamedTexture{
+        // in the scene's texture list, holds a placeholder texel until update_textures swaps the decoded mips in
+        std::list<Texture>::iterator texture;
+        // material pointers to texture, they are moved over when another file turns out to have the same content
+        std::vector<Texture**> users;
+
+        // written by the decoding job before it sets is_decoded
+        Texture decoded;
+        StreamedTexture* same_content = nullptr;
+        std::atomic<bool> is_decoded{false};
+
+        bool is_swapped = false;
+    };
+
+    // textures streamed into a scene's texture list. files are decoded by jobs on idle workers
+    // while frames are drawn with placeholders, the render loop calls update_textures to swap the
+    // finished ones in. declare it after the scene, it waits for its jobs when it goes out of scope.
+    struct TextureCache{
+        std::list<Texture>* textures = nullptr;
+
+        std::list<StreamedTexture> entries;
+        std::unordered_map<std::string, StreamedTexture*> by_path;
+        std::vector<StreamedTexture*> streaming; // requested and not swapped in yet
+        std::vector<std::function<void()>> when_streamed;
+
+        // hash of the file contents to the first entry with them, filled by the decoding jobs
+        std::mutex content_mutex;
+        std::unordered_map<std::uint64_t, StreamedTexture*> by_content;
+
+        std::atomic<std::uint32_t> jobs_in_flight{0};
+
+        ~TextureCache(){
+            while (jobs_in_flight.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+        }
+    };
+
+    inline void run_job(TextureCache* cache, std::function<void()> work){
+        cache->jobs_in_flight.fetch_add(1);
+        Renderer::run_async([cache, work = std::move(work)]{
+            work();
+            cache->jobs_in_flight.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // files whose bytes were seen before are not decoded again
+    inline void decode_texture(TextureCache* cache, StreamedTexture* entry, const std::string& name, const std::vector<std::uint8_t>& bytes){
+        if (!bytes.empty()){
+            const std::uint64_t hash = SceneCache::hash_bytes(1469598103934665603ull, bytes.data(), bytes.size());
+            std::lock_guard lock(cache->content_mutex);
+            const auto [it, is_new] = cache->by_content.try_emplace(hash, entry);
+            if (!is_new) entry->same_content = it->second;
+        }
+
+        if (entry->same_content == nullptr){
+            entry->decoded.mipmaps.push_back(Renderer::load_image_from_memory(bytes.data(), bytes.size()));
+            Renderer::generate_mipmaps(&entry->decoded);
+            const Renderer::Image<Renderer::R8G8B8A8_U>& image = entry->decoded.mipmaps[0];
+            std::cout << "load file:" + name + ", size=" + std::to_string(image.width) + "x" + std::to_string(image.height) + "\n";
+        }
+        entry->is_decoded.store(true, std::memory_order_release);
+    }
+
+    inline void start_when_streamed(TextureCache* cache){
+        for (std::function<void()>& work : cache->when_streamed) run_job(cache, std::move(work));
+        cache->when_streamed.clear();
+    }
+
+    // points *user at the texture called key. the first request of a key adds a texture holding a
+    // single placeholder texel to the list and queues read_and_decode, later requests of the same
+    // key share that texture. *user may be changed by update_textures, so it has to stay put.
+    inline void add_request(TextureCache* cache, const std::string& key, Texture** user, Renderer::R8G8B8A8_U placeholder,
+                            const std::function<void(StreamedTexture*)>& read_and_decode){
+        const auto [it, is_new] = cache->by_path.try_emplace(key, nullptr);
+        if (is_new){
+            StreamedTexture& entry = cache->entries.emplace_back();
+            entry.texture = cache->textures->insert(cache->textures->end(), Texture{
+                .mipmaps = { Renderer::Image<Renderer::R8G8B8A8_U>{ .image = {placeholder}, .width = 1, .height = 1 } },
+            });
+            it->second = &entry;
+            cache->streaming.push_back(&entry);
+            run_job(cache, [read_and_decode, entry = &entry]{ read_and_decode(entry); });
+        }
+
+        StreamedTexture* entry = it->second;
+        *user = &*entry->texture;
+        if (!entry->is_swapped) entry->users.push_back(user);
+    }
+
+    // texture of an image file, see add_request. the file is read by the decoding job.
+    inline void request_texture(TextureCache* cache, const std::filesystem::path& path, Texture** user, Renderer::R8G8B8A8_U placeholder){
+        std::error_code error;
+        const std::filesystem::path canonical_path = std::filesystem::weakly_canonical(path, error);
+        add_request(cache, (error ? path : canonical_path).generic_string(), user, placeholder, [cache, path](StreamedTexture* entry){
+            std::vector<std::uint8_t> bytes;
+            std::ifstream file(path, std::ios::binary);
+            if (file) bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            decode_texture(cache, entry, path.string(), bytes);
+        });
+    }
+
+    // texture of an image file that is already in memory, like one embedded in a gltf file, see
+    // add_request. key names it for the path deduplication and must not collide with file paths.
+    inline void request_encoded_texture(TextureCache* cache, const std::string& key, std::vector<std::uint8_t> bytes, Texture** user, Renderer::R8G8B8A8_U placeholder){
+        auto shared_bytes = std::make_shared<const std::vector<std::uint8_t>>(std::move(bytes));
+        add_request(cache, key, user, placeholder, [cache, key, shared_bytes](StreamedTexture* entry){
+            decode_texture(cache, entry, key, *shared_bytes);
+        });
+    }
+
+    // to be called by the render loop between frames. swaps in the mips of every texture that
+    // finished decoding and returns how many were swapped in, it never waits for a decode.
+    // a file with the same content as another one waits for it and then hands its users over.
+    inline std::uint32_t update_textures(TextureCache* cache){
+        std::uint32_t swapped_count = 0;
+        for (StreamedTexture* entry : cache->streaming){
+            if (!entry->is_decoded.load(std::memory_order_acquire)) continue;
+
+            if (StreamedTexture* original = entry->same_content){
+                if (!original->is_swapped) continue;
+                for (Texture** user : entry->users) *user = &*original->texture;
+                cache->textures->erase(entry->texture);
+                entry->texture = original->texture;
+            } else if (entry->decoded.mipmaps[0].width > 0 && entry->decoded.mipmaps[0].height > 0){
+                entry->texture->mipmaps = std::move(entry->decoded.mipmaps);
+            }
+            // a file that failed to decode keeps its placeholder
+            entry->decoded = Texture{};
+            entry->users.clear();
+            entry->is_swapped = true;
+            swapped_count++;
+        }
+        if (swapped_count == 0) return 0;
+
+        std::erase_if(cache->streaming, [](const StreamedTexture* entry){ return entry->is_swapped; });
+        if (cache->streaming.empty()) start_when_streamed(cache);
+        return swapped_count;
+    }
+
+    inline std::uint32_t get_streaming_count(const TextureCache& cache){
+        return static_cast<std::uint32_t>(cache.streaming.size());
+    }
+
+    // runs work on a worker once every texture requested so far is swapped in, right away when
+    // none is left. frames may be drawn from the textures meanwhile, so work should only read them.
+    inline void run_when_streamed(TextureCache* cache, std::function<void()> work){
+        cache->when_streamed.push_back(std::move(work));
+        if (cache->streaming.empty()) start_when_streamed(cache);
+    }
+}